@@ -0,0 +1,838 @@
+// Copyright 2019 Nedelcu Horia (nedelcu.horia.alexandru@gmail.com)
+
+/**
+*    Adaptive Trie Implementation:
+*
+*    Trie (adaptive radix tree) over keys of arbitrary bytes, with the same
+* operations as Trie. An inner node has one of four sizes, picked by its
+* number of children and changed as they come and go:
+*        Node4   - up to 4 sorted key bytes and children
+*        Node16  - up to 16 sorted key bytes, searched with one SSE2 compare
+*        Node48  - a 256 byte index into 48 children
+*        Node256 - 256 children, indexed by the byte
+* so a node with one child takes 72 bytes instead of a vector of 26
+* pointers per character.
+*    The bytes that all the keys below a node share (a chain of nodes with
+* one child) are kept in the node as its prefix: the first ART_MAX_PREFIX
+* of them in the node, the others are checked on the leaf, which holds the
+* whole key. A key that ends in an inner node (it is a prefix of other
+* keys) is its end_ leaf. Every inner node counts the keys below it, for
+* numWordsWithPrefix.
+*/
+
+#ifndef ADAPTIVE_TRIE_H_
+#define ADAPTIVE_TRIE_H_
+
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define ART_MAX_PREFIX 8
+
+enum ArtType { ART_LEAF, ART_NODE4, ART_NODE16, ART_NODE48, ART_NODE256 };
+
+struct ArtNode {
+    uint8_t type_;
+
+    explicit ArtNode(uint8_t type): type_(type) {}
+};
+
+template <class T>
+struct ArtLeaf : ArtNode {
+    std::string key_;
+    T value_;
+
+    ArtLeaf(const std::string& key, const T& value): ArtNode(ART_LEAF),
+        key_(key), value_(value) {}
+};
+
+struct ArtInner : ArtNode {
+    uint16_t num_;
+    uint32_t prefix_len_;
+    uint32_t count_;
+    uint8_t prefix_[ART_MAX_PREFIX];
+    ArtNode *end_;
+
+    explicit ArtInner(uint8_t type): ArtNode(type), num_(0), prefix_len_(0),
+        count_(0), end_(NULL) {}
+};
+
+struct ArtNode4 : ArtInner {
+    uint8_t keys_[4];
+    ArtNode *children_[4];
+
+    ArtNode4(): ArtInner(ART_NODE4) {}
+};
+
+struct ArtNode16 : ArtInner {
+    uint8_t keys_[16];
+    ArtNode *children_[16];
+
+    ArtNode16(): ArtInner(ART_NODE16) {}
+};
+
+struct ArtNode48 : ArtInner {
+    uint8_t index_[256];
+    ArtNode *children_[48];
+
+    ArtNode48(): ArtInner(ART_NODE48) {
+        memset(index_, 0, sizeof(index_));
+        memset(children_, 0, sizeof(children_));
+    }
+};
+
+struct ArtNode256 : ArtInner {
+    ArtNode *children_[256];
+
+    ArtNode256(): ArtInner(ART_NODE256) {
+        memset(children_, 0, sizeof(children_));
+    }
+};
+
+template <class T>
+class AdaptiveTrie {
+    ArtNode *root_;
+
+ public:
+    AdaptiveTrie();
+    ~AdaptiveTrie();
+
+    AdaptiveTrie(const AdaptiveTrie<T>&) = delete;
+    AdaptiveTrie<T>& operator=(const AdaptiveTrie<T>&) = delete;
+
+    void insert(const std::string&, T value);
+    bool search(const std::string&, T& value);
+    bool remove(const std::string&);
+    int numWordsWithPrefix(const std::string&);
+
+ private:
+    bool insert(ArtNode*&, const std::string&, const T&, int);
+    bool remove(ArtNode*&, const std::string&, int);
+    void destroy(ArtNode*);
+
+    static ArtNode** findChild(ArtInner*, uint8_t);
+    static void addChild(ArtNode*&, uint8_t, ArtNode*);
+    static void removeChild(ArtInner*, uint8_t);
+    static void shrink(ArtNode*&);
+    static void copyHeader(ArtInner*, const ArtInner*);
+    static ArtLeaf<T>* anyLeaf(ArtNode*);
+    static int matchPrefix(ArtInner*, const std::string&, int);
+    static int firstBit(unsigned int);
+};
+
+/*
+ * Implementation:
+ */
+
+template <class T>
+AdaptiveTrie<T> :: AdaptiveTrie(): root_(NULL) {}
+
+template <class T>
+AdaptiveTrie<T> :: ~AdaptiveTrie() {
+    destroy(root_);
+}
+
+/*
+ * Insert key or change its value.
+ * O(length of key)
+ */
+template <class T>
+void
+AdaptiveTrie<T> :: insert(const std::string& key, T value) {
+    insert(root_, key, value, 0);
+}
+
+/*
+ * The prefixes longer than the node keeps are skipped on the way down and
+ * the whole key is compared on the leaf.
+ * O(length of key)
+ */
+template <class T>
+bool
+AdaptiveTrie<T> :: search(const std::string& key, T& value) {
+    ArtNode *node = root_, **child;
+    ArtInner *inner;
+    int depth = 0, size = static_cast<int>(key.size());
+
+    while (node && node->type_ != ART_LEAF) {
+        inner = static_cast<ArtInner*>(node);
+
+        for (uint32_t i = 0; i < inner->prefix_len_ && i < ART_MAX_PREFIX
+            && depth + static_cast<int>(i) < size; ++i) {
+            if (inner->prefix_[i] != static_cast<uint8_t>(key[depth + i])) {
+                return false;
+            }
+        }
+
+        depth += inner->prefix_len_;
+        if (depth >= size) {
+            node = (depth == size)? inner->end_: NULL;
+            break;
+        }
+
+        child = findChild(inner, static_cast<uint8_t>(key[depth++]));
+        node = child? *child: NULL;
+    }
+
+    if (!node || static_cast<ArtLeaf<T>*>(node)->key_ != key) {
+        return false;
+    }
+
+    value = static_cast<ArtLeaf<T>*>(node)->value_;
+    return true;
+}
+
+/*
+ * O(length of key)
+ */
+template <class T>
+bool
+AdaptiveTrie<T> :: remove(const std::string& key) {
+    return remove(root_, key, 0);
+}
+
+/*
+ * Number of keys that start with prefix.
+ * O(length of prefix)
+ */
+template <class T>
+int
+AdaptiveTrie<T> :: numWordsWithPrefix(const std::string& prefix) {
+    ArtNode *node = root_, **child;
+    ArtInner *inner;
+    ArtLeaf<T> *leaf;
+    int depth = 0, size = static_cast<int>(prefix.size());
+
+    while (node && node->type_ != ART_LEAF) {
+        inner = static_cast<ArtInner*>(node);
+
+        if (depth + static_cast<int>(inner->prefix_len_) >= size) {
+            break;
+        }
+
+        depth += inner->prefix_len_;
+        child = findChild(inner, static_cast<uint8_t>(prefix[depth++]));
+        node = child? *child: NULL;
+    }
+
+    if (!node) {
+        return 0;
+    }
+
+    // All the keys below node share the bytes of the path, so one of them
+    // tells if they all start with prefix
+    leaf = anyLeaf(node);
+    if (leaf->key_.compare(0, prefix.size(), prefix) != 0) {
+        return 0;
+    }
+
+    return (node->type_ == ART_LEAF)? 1: static_cast<ArtInner*>(node)->count_;
+}
+
+/*
+ * Insert in the subtree of ref, whose nodes are at depth bytes of the key.
+ * Return true if the key is new.
+ */
+template <class T>
+bool
+AdaptiveTrie<T> :: insert(ArtNode*& ref, const std::string& key,
+    const T& value, int depth) {
+    int size = static_cast<int>(key.size()), match;
+    ArtNode **child;
+    ArtLeaf<T> *leaf;
+    ArtInner *inner;
+    ArtNode4 *parent;
+
+    if (!ref) {
+        ref = new ArtLeaf<T>(key, value);
+        return true;
+    }
+
+    if (ref->type_ == ART_LEAF) {
+        leaf = static_cast<ArtLeaf<T>*>(ref);
+        if (leaf->key_ == key) {
+            leaf->value_ = value;
+            return false;
+        }
+
+        // Two keys: a Node4 on the bytes they share, each below its byte
+        // (or as end_ if it ends there)
+        parent = new ArtNode4();
+        for (match = depth; match < size && match < static_cast<int>(
+            leaf->key_.size()) && leaf->key_[match] == key[match]; ++match) {
+            if (match - depth < ART_MAX_PREFIX) {
+                parent->prefix_[match - depth] = key[match];
+            }
+        }
+
+        parent->prefix_len_ = match - depth;
+        parent->count_ = 2;
+        ref = parent;
+
+        if (match == static_cast<int>(leaf->key_.size())) {
+            parent->end_ = leaf;
+        } else {
+            addChild(ref, static_cast<uint8_t>(leaf->key_[match]), leaf);
+        }
+
+        if (match == size) {
+            parent->end_ = new ArtLeaf<T>(key, value);
+        } else {
+            addChild(ref, static_cast<uint8_t>(key[match]),
+                new ArtLeaf<T>(key, value));
+        }
+
+        return true;
+    }
+
+    inner = static_cast<ArtInner*>(ref);
+    match = matchPrefix(inner, key, depth);
+
+    if (match < static_cast<int>(inner->prefix_len_)) {
+        // The key leaves the prefix: a Node4 on the matched bytes, the old
+        // node below the next byte of its prefix, the key below its own
+        uint8_t byte;
+
+        parent = new ArtNode4();
+        parent->prefix_len_ = match;
+        memcpy(parent->prefix_, inner->prefix_,
+            std::min(match, ART_MAX_PREFIX));
+        parent->count_ = inner->count_ + 1;
+
+        if (inner->prefix_len_ <= ART_MAX_PREFIX) {
+            byte = inner->prefix_[match];
+            memmove(inner->prefix_, inner->prefix_ + match + 1,
+                inner->prefix_len_ - match - 1);
+        } else {
+            leaf = anyLeaf(inner);
+            byte = static_cast<uint8_t>(leaf->key_[depth + match]);
+            memcpy(inner->prefix_, leaf->key_.data() + depth + match + 1,
+                std::min<int>(inner->prefix_len_ - match - 1, ART_MAX_PREFIX));
+        }
+        inner->prefix_len_ -= match + 1;
+
+        ref = parent;
+        addChild(ref, byte, inner);
+
+        if (depth + match == size) {
+            parent->end_ = new ArtLeaf<T>(key, value);
+        } else {
+            addChild(ref, static_cast<uint8_t>(key[depth + match]),
+                new ArtLeaf<T>(key, value));
+        }
+
+        return true;
+    }
+
+    depth += inner->prefix_len_;
+
+    if (depth == size) {
+        if (inner->end_) {
+            static_cast<ArtLeaf<T>*>(inner->end_)->value_ = value;
+            return false;
+        }
+
+        inner->end_ = new ArtLeaf<T>(key, value);
+        ++inner->count_;
+        return true;
+    }
+
+    child = findChild(inner, static_cast<uint8_t>(key[depth]));
+    if (child) {
+        if (!insert(*child, key, value, depth + 1)) {
+            return false;
+        }
+
+        ++inner->count_;
+        return true;
+    }
+
+    ++inner->count_;
+    addChild(ref, static_cast<uint8_t>(key[depth]), new ArtLeaf<T>(key, value));
+
+    return true;
+}
+
+/*
+ * Remove from the subtree of ref; the nodes on the way shrink or are
+ * merged with their only child. Return true if the key was found.
+ */
+template <class T>
+bool
+AdaptiveTrie<T> :: remove(ArtNode*& ref, const std::string& key, int depth) {
+    int size = static_cast<int>(key.size());
+    ArtNode **child;
+    ArtInner *inner;
+    uint8_t byte;
+
+    if (!ref) {
+        return false;
+    }
+
+    if (ref->type_ == ART_LEAF) {
+        if (static_cast<ArtLeaf<T>*>(ref)->key_ != key) {
+            return false;
+        }
+
+        delete static_cast<ArtLeaf<T>*>(ref);
+        ref = NULL;
+        return true;
+    }
+
+    inner = static_cast<ArtInner*>(ref);
+    if (matchPrefix(inner, key, depth) < static_cast<int>(inner->prefix_len_)) {
+        return false;
+    }
+
+    depth += inner->prefix_len_;
+
+    if (depth == size) {
+        if (!inner->end_) {
+            return false;
+        }
+
+        delete static_cast<ArtLeaf<T>*>(inner->end_);
+        inner->end_ = NULL;
+    } else {
+        byte = static_cast<uint8_t>(key[depth]);
+        child = findChild(inner, byte);
+
+        if (!child || !remove(*child, key, depth + 1)) {
+            return false;
+        }
+
+        if (!*child) {
+            removeChild(inner, byte);
+        }
+    }
+
+    --inner->count_;
+    shrink(ref);
+
+    return true;
+}
+
+template <class T>
+void
+AdaptiveTrie<T> :: destroy(ArtNode* node) {
+    if (!node) {
+        return;
+    }
+
+    if (node->type_ == ART_LEAF) {
+        delete static_cast<ArtLeaf<T>*>(node);
+        return;
+    }
+
+    ArtInner *inner = static_cast<ArtInner*>(node);
+    destroy(inner->end_);
+
+    switch (node->type_) {
+    case ART_NODE4:
+        for (int i = 0; i < inner->num_; ++i) {
+            destroy(static_cast<ArtNode4*>(node)->children_[i]);
+        }
+        delete static_cast<ArtNode4*>(node);
+        break;
+    case ART_NODE16:
+        for (int i = 0; i < inner->num_; ++i) {
+            destroy(static_cast<ArtNode16*>(node)->children_[i]);
+        }
+        delete static_cast<ArtNode16*>(node);
+        break;
+    case ART_NODE48:
+        for (int i = 0; i < 48; ++i) {
+            destroy(static_cast<ArtNode48*>(node)->children_[i]);
+        }
+        delete static_cast<ArtNode48*>(node);
+        break;
+    default:
+        for (int i = 0; i < 256; ++i) {
+            destroy(static_cast<ArtNode256*>(node)->children_[i]);
+        }
+        delete static_cast<ArtNode256*>(node);
+    }
+}
+
+/*
+ * The slot of the child for byte, NULL if there is none.
+ */
+template <class T>
+ArtNode**
+AdaptiveTrie<T> :: findChild(ArtInner* inner, uint8_t byte) {
+    switch (inner->type_) {
+    case ART_NODE4: {
+        ArtNode4 *node = static_cast<ArtNode4*>(inner);
+
+        for (int i = 0; i < node->num_; ++i) {
+            if (node->keys_[i] == byte) {
+                return &node->children_[i];
+            }
+        }
+
+        return NULL;
+    }
+    case ART_NODE16: {
+        ArtNode16 *node = static_cast<ArtNode16*>(inner);
+#if defined(__SSE2__)
+        __m128i equal = _mm_cmpeq_epi8(_mm_set1_epi8(static_cast<char>(byte)),
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(node->keys_)));
+        unsigned int mask = _mm_movemask_epi8(equal) & ((1u << node->num_) - 1);
+
+        return mask? &node->children_[firstBit(mask)]: NULL;
+#else
+        for (int i = 0; i < node->num_; ++i) {
+            if (node->keys_[i] == byte) {
+                return &node->children_[i];
+            }
+        }
+
+        return NULL;
+#endif
+    }
+    case ART_NODE48: {
+        ArtNode48 *node = static_cast<ArtNode48*>(inner);
+
+        return node->index_[byte]? &node->children_[node->index_[byte] - 1]:
+            NULL;
+    }
+    default: {
+        ArtNode256 *node = static_cast<ArtNode256*>(inner);
+
+        return node->children_[byte]? &node->children_[byte]: NULL;
+    }
+    }
+}
+
+/*
+ * Add child for byte (not in the node yet); a full node is replaced in ref
+ * by one of the next size.
+ */
+template <class T>
+void
+AdaptiveTrie<T> :: addChild(ArtNode*& ref, uint8_t byte, ArtNode* child) {
+    ArtInner *inner = static_cast<ArtInner*>(ref);
+    int pos;
+
+    switch (ref->type_) {
+    case ART_NODE4: {
+        ArtNode4 *node = static_cast<ArtNode4*>(ref);
+
+        if (node->num_ < 4) {
+            for (pos = 0; pos < node->num_ && node->keys_[pos] < byte; ++pos) {}
+
+            memmove(node->keys_ + pos + 1, node->keys_ + pos,
+                node->num_ - pos);
+            memmove(node->children_ + pos + 1, node->children_ + pos,
+                (node->num_ - pos) * sizeof(ArtNode*));
+            node->keys_[pos] = byte;
+            node->children_[pos] = child;
+            ++node->num_;
+            return;
+        }
+
+        ArtNode16 *grown = new ArtNode16();
+        copyHeader(grown, node);
+        memcpy(grown->keys_, node->keys_, 4);
+        memcpy(grown->children_, node->children_, 4 * sizeof(ArtNode*));
+        delete node;
+        ref = grown;
+        break;
+    }
+    case ART_NODE16: {
+        ArtNode16 *node = static_cast<ArtNode16*>(ref);
+
+        if (node->num_ < 16) {
+            for (pos = 0; pos < node->num_ && node->keys_[pos] < byte; ++pos) {}
+
+            memmove(node->keys_ + pos + 1, node->keys_ + pos,
+                node->num_ - pos);
+            memmove(node->children_ + pos + 1, node->children_ + pos,
+                (node->num_ - pos) * sizeof(ArtNode*));
+            node->keys_[pos] = byte;
+            node->children_[pos] = child;
+            ++node->num_;
+            return;
+        }
+
+        ArtNode48 *grown = new ArtNode48();
+        copyHeader(grown, node);
+        for (int i = 0; i < 16; ++i) {
+            grown->children_[i] = node->children_[i];
+            grown->index_[node->keys_[i]] = i + 1;
+        }
+        delete node;
+        ref = grown;
+        break;
+    }
+    case ART_NODE48: {
+        ArtNode48 *node = static_cast<ArtNode48*>(ref);
+
+        if (node->num_ < 48) {
+            for (pos = 0; node->children_[pos]; ++pos) {}
+
+            node->children_[pos] = child;
+            node->index_[byte] = pos + 1;
+            ++node->num_;
+            return;
+        }
+
+        ArtNode256 *grown = new ArtNode256();
+        copyHeader(grown, node);
+        for (int i = 0; i < 256; ++i) {
+            if (node->index_[i]) {
+                grown->children_[i] = node->children_[node->index_[i] - 1];
+            }
+        }
+        delete node;
+        ref = grown;
+        break;
+    }
+    default:
+        static_cast<ArtNode256*>(ref)->children_[byte] = child;
+        ++inner->num_;
+        return;
+    }
+
+    addChild(ref, byte, child);
+}
+
+/*
+ * Take out the (empty) slot of byte.
+ */
+template <class T>
+void
+AdaptiveTrie<T> :: removeChild(ArtInner* inner, uint8_t byte) {
+    int pos;
+
+    switch (inner->type_) {
+    case ART_NODE4: {
+        ArtNode4 *node = static_cast<ArtNode4*>(inner);
+
+        for (pos = 0; node->keys_[pos] != byte; ++pos) {}
+        memmove(node->keys_ + pos, node->keys_ + pos + 1,
+            node->num_ - pos - 1);
+        memmove(node->children_ + pos, node->children_ + pos + 1,
+            (node->num_ - pos - 1) * sizeof(ArtNode*));
+        break;
+    }
+    case ART_NODE16: {
+        ArtNode16 *node = static_cast<ArtNode16*>(inner);
+
+        for (pos = 0; node->keys_[pos] != byte; ++pos) {}
+        memmove(node->keys_ + pos, node->keys_ + pos + 1,
+            node->num_ - pos - 1);
+        memmove(node->children_ + pos, node->children_ + pos + 1,
+            (node->num_ - pos - 1) * sizeof(ArtNode*));
+        break;
+    }
+    case ART_NODE48: {
+        ArtNode48 *node = static_cast<ArtNode48*>(inner);
+
+        node->children_[node->index_[byte] - 1] = NULL;
+        node->index_[byte] = 0;
+        break;
+    }
+    default:
+        static_cast<ArtNode256*>(inner)->children_[byte] = NULL;
+    }
+
+    --inner->num_;
+}
+
+/*
+ * After a removal: a node with few children goes to the smaller size (with
+ * some slack, so a node on the limit doesn't keep changing), a Node4 left
+ * with a single entry is replaced by it (a child gets the prefix of the
+ * node and its byte in front of its own).
+ */
+template <class T>
+void
+AdaptiveTrie<T> :: shrink(ArtNode*& ref) {
+    ArtInner *inner = static_cast<ArtInner*>(ref);
+
+    switch (ref->type_) {
+    case ART_NODE4: {
+        ArtNode4 *node = static_cast<ArtNode4*>(ref);
+
+        if (node->num_ == 0 && node->end_) {
+            ref = node->end_;
+            delete node;
+        } else if (node->num_ == 1 && !node->end_) {
+            ArtNode *child = node->children_[0];
+
+            if (child->type_ != ART_LEAF) {
+                ArtInner *below = static_cast<ArtInner*>(child);
+                uint8_t prefix[ART_MAX_PREFIX] = {};
+                int len = std::min<int>(node->prefix_len_, ART_MAX_PREFIX);
+
+                memcpy(prefix, node->prefix_, len);
+                if (len < ART_MAX_PREFIX) {
+                    prefix[len++] = node->keys_[0];
+                }
+                memcpy(prefix + len, below->prefix_,
+                    std::min<int>(below->prefix_len_, ART_MAX_PREFIX - len));
+                memcpy(below->prefix_, prefix, ART_MAX_PREFIX);
+                below->prefix_len_ += node->prefix_len_ + 1;
+            }
+
+            ref = child;
+            delete node;
+        }
+        break;
+    }
+    case ART_NODE16: {
+        ArtNode16 *node = static_cast<ArtNode16*>(ref);
+
+        if (node->num_ <= 3) {
+            ArtNode4 *shrunk = new ArtNode4();
+            copyHeader(shrunk, node);
+            memcpy(shrunk->keys_, node->keys_, node->num_);
+            memcpy(shrunk->children_, node->children_,
+                node->num_ * sizeof(ArtNode*));
+            delete node;
+            ref = shrunk;
+        }
+        break;
+    }
+    case ART_NODE48: {
+        ArtNode48 *node = static_cast<ArtNode48*>(ref);
+
+        if (node->num_ <= 12) {
+            ArtNode16 *shrunk = new ArtNode16();
+            int pos = 0;
+
+            copyHeader(shrunk, node);
+            for (int i = 0; i < 256; ++i) {
+                if (node->index_[i]) {
+                    shrunk->keys_[pos] = i;
+                    shrunk->children_[pos++] = node->children_[
+                        node->index_[i] - 1];
+                }
+            }
+            delete node;
+            ref = shrunk;
+        }
+        break;
+    }
+    default: {
+        ArtNode256 *node = static_cast<ArtNode256*>(ref);
+
+        if (inner->num_ <= 37) {
+            ArtNode48 *shrunk = new ArtNode48();
+            int pos = 0;
+
+            copyHeader(shrunk, node);
+            for (int i = 0; i < 256; ++i) {
+                if (node->children_[i]) {
+                    shrunk->children_[pos] = node->children_[i];
+                    shrunk->index_[i] = ++pos;
+                }
+            }
+            delete node;
+            ref = shrunk;
+        }
+    }
+    }
+}
+
+template <class T>
+void
+AdaptiveTrie<T> :: copyHeader(ArtInner* to, const ArtInner* from) {
+    to->num_ = from->num_;
+    to->prefix_len_ = from->prefix_len_;
+    to->count_ = from->count_;
+    memcpy(to->prefix_, from->prefix_, ART_MAX_PREFIX);
+    to->end_ = from->end_;
+}
+
+/*
+ * Some leaf of the subtree of node (they all share the bytes of the path).
+ */
+template <class T>
+ArtLeaf<T>*
+AdaptiveTrie<T> :: anyLeaf(ArtNode* node) {
+    ArtNode **child;
+    ArtInner *inner;
+
+    while (node->type_ != ART_LEAF) {
+        inner = static_cast<ArtInner*>(node);
+
+        if (inner->end_) {
+            return static_cast<ArtLeaf<T>*>(inner->end_);
+        }
+
+        switch (node->type_) {
+        case ART_NODE4:
+            node = static_cast<ArtNode4*>(node)->children_[0];
+            break;
+        case ART_NODE16:
+            node = static_cast<ArtNode16*>(node)->children_[0];
+            break;
+        case ART_NODE48:
+            for (child = static_cast<ArtNode48*>(node)->children_; !*child;
+                ++child) {}
+            node = *child;
+            break;
+        default:
+            for (child = static_cast<ArtNode256*>(node)->children_; !*child;
+                ++child) {}
+            node = *child;
+        }
+    }
+
+    return static_cast<ArtLeaf<T>*>(node);
+}
+
+/*
+ * Number of bytes of the prefix of inner that key has from depth on. The
+ * bytes after the first ART_MAX_PREFIX are read from a leaf below.
+ */
+template <class T>
+int
+AdaptiveTrie<T> :: matchPrefix(ArtInner* inner, const std::string& key,
+    int depth) {
+    int len = inner->prefix_len_, size = static_cast<int>(key.size()), i;
+    ArtLeaf<T> *leaf;
+
+    for (i = 0; i < len && i < ART_MAX_PREFIX && depth + i < size; ++i) {
+        if (inner->prefix_[i] != static_cast<uint8_t>(key[depth + i])) {
+            return i;
+        }
+    }
+
+    if (i < len && depth + i < size) {
+        leaf = anyLeaf(inner);
+
+        for (; i < len && depth + i < size; ++i) {
+            if (leaf->key_[depth + i] != key[depth + i]) {
+                return i;
+            }
+        }
+    }
+
+    return i;
+}
+
+template <class T>
+int
+AdaptiveTrie<T> :: firstBit(unsigned int mask) {
+#if defined(__GNUC__)
+    return __builtin_ctz(mask);
+#else
+    int bit = 0;
+
+    for (; !(mask & 1); mask >>= 1) {
+        ++bit;
+    }
+
+    return bit;
+#endif
+}
+
+#endif  // ADAPTIVE_TRIE_H_
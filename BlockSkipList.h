@@ -0,0 +1,879 @@
+// Copyright 2019 Nedelcu Horia (nedelcu.horia.alexandru@gmail.com)
+
+/**
+*    Block SkipList Implementation:
+*
+*    SkipList variant where each node keeps a small sorted block of keys
+* (and their counts) that fills about BLOCK_BYTES of memory, so the list has
+* many times fewer nodes and the lowest levels are read a cache line at a
+* time instead of a pointer at a time. The nodes are the Node / NodePool of
+* SkipList with a Block as data: count is the number of keys in the block
+* and span counts the keys up to the next node on the level (jump is not
+* used), which keeps operator[] logarithmic.
+*    Search to find by key: the towers are searched by the first key of the
+* blocks (the last block starting before or at the key), then the key is
+* searched inside the block. For int / unsigned / 64 bit integers / float /
+* double keys with the default order the block is compared with SIMD
+* instructions (SSE2, SSE4.2, AVX2 when the compiler targets them). Without
+* SSE4.2 the 64 bit integers are compared as pairs of 32 bit halves.
+*    A full block is split in two halves (the new half gets its own tower)
+* and a block left without keys is unlinked.
+*/
+
+#ifndef BLOCK_SKIP_LIST_H_
+#define BLOCK_SKIP_LIST_H_
+
+#include <iostream>
+#include <type_traits>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "SkipList.h"
+
+#define BLOCK_BYTES 128
+
+template <class T> struct Block;
+template <class T, class Comparator, class Enable = void> struct BlockSearch;
+template <class T, class Comparator = DefaulComparator<T>,
+    class Policy = SkipListPolicy<> > class BlockSkipList;
+
+template <class T>
+struct Block {
+    static const int kKeys = (BLOCK_BYTES / sizeof(T) < 4)? 4:
+        BLOCK_BYTES / sizeof(T);
+
+    T keys_[kKeys];
+    int counts_[kKeys];
+
+    Block(): keys_(), counts_() {}
+};
+
+/*
+ * Number of keys of a sorted block that come before key.
+ * The generic version walks the block with the comparator.
+ */
+template <class T, class Comparator, class Enable>
+struct BlockSearch {
+    static int rank(const T* keys, int size, const T& key, Comparator& comp) {
+        int i = 0;
+
+        while (i < size && comp(key, keys[i])) {
+            ++i;
+        }
+
+        return i;
+    }
+};
+
+/*
+ * SIMD version: the keys are compared in groups and the number of smaller
+ * keys is counted from the comparison masks. The kind of a key selects the
+ * instructions: 1 int32, 2 uint32, 3 int64, 4 uint64, 5 float, 6 double,
+ * 0 no SIMD (walk the block).
+ */
+template <class T>
+struct SimdKind {
+    static const int value = std::is_floating_point<T>::value?
+        (sizeof(T) == 4? 5: sizeof(T) == 8? 6: 0):
+        !std::is_integral<T>::value? 0:
+        sizeof(T) == 4? (std::is_signed<T>::value? 1: 2):
+        sizeof(T) == 8? (std::is_signed<T>::value? 3: 4): 0;
+};
+
+inline int popCount(unsigned int mask) {
+#if defined(__GNUC__)
+    return __builtin_popcount(mask);
+#else
+    int count = 0;
+
+    for (; mask; mask &= mask - 1) {
+        ++count;
+    }
+
+    return count;
+#endif
+}
+
+template <class T, int Kind>
+inline int simdRank(const T* keys, int size, T key,
+    std::integral_constant<int, Kind>) {
+    int i = 0;
+
+    while (i < size && keys[i] < key) {
+        ++i;
+    }
+
+    return i;
+}
+
+#if defined(__SSE2__)
+template <class T>
+inline int simdRank(const T* keys, int size, T key,
+    std::integral_constant<int, 1>) {
+    int i = 0, rank = 0;
+
+#if defined(__AVX2__)
+    __m256i wide_key = _mm256_set1_epi32(static_cast<int>(key));
+    for (; i + 8 <= size; i += 8) {
+        __m256i values = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i*>(keys + i));
+        rank += popCount(_mm256_movemask_ps(_mm256_castsi256_ps(
+            _mm256_cmpgt_epi32(wide_key, values))));
+    }
+#endif
+
+    __m128i pattern = _mm_set1_epi32(static_cast<int>(key));
+    for (; i + 4 <= size; i += 4) {
+        __m128i values = _mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(keys + i));
+        rank += popCount(_mm_movemask_ps(_mm_castsi128_ps(
+            _mm_cmpgt_epi32(pattern, values))));
+    }
+
+    for (; i < size; ++i) {
+        rank += keys[i] < key;
+    }
+
+    return rank;
+}
+
+/*
+ * Unsigned keys: flip the sign bit on both sides, then compare signed.
+ */
+template <class T>
+inline int simdRank(const T* keys, int size, T key,
+    std::integral_constant<int, 2>) {
+    int i = 0, rank = 0;
+    const int sign = static_cast<int>(0x80000000u);
+
+#if defined(__AVX2__)
+    __m256i wide_sign = _mm256_set1_epi32(sign);
+    __m256i wide_key = _mm256_xor_si256(_mm256_set1_epi32(
+        static_cast<int>(key)), wide_sign);
+    for (; i + 8 <= size; i += 8) {
+        __m256i values = _mm256_xor_si256(_mm256_loadu_si256(
+            reinterpret_cast<const __m256i*>(keys + i)), wide_sign);
+        rank += popCount(_mm256_movemask_ps(_mm256_castsi256_ps(
+            _mm256_cmpgt_epi32(wide_key, values))));
+    }
+#endif
+
+    __m128i flip = _mm_set1_epi32(sign);
+    __m128i pattern = _mm_xor_si128(_mm_set1_epi32(static_cast<int>(key)),
+        flip);
+    for (; i + 4 <= size; i += 4) {
+        __m128i values = _mm_xor_si128(_mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(keys + i)), flip);
+        rank += popCount(_mm_movemask_ps(_mm_castsi128_ps(
+            _mm_cmpgt_epi32(pattern, values))));
+    }
+
+    for (; i < size; ++i) {
+        rank += keys[i] < key;
+    }
+
+    return rank;
+}
+
+/*
+ * a > b for the two signed 64 bit lanes. SSE2 alone has only 32 bit
+ * compares: the high halves decide (signed), or if they are equal the low
+ * halves (unsigned, so compared with the sign bit flipped).
+ */
+inline __m128i greaterThan64(__m128i a, __m128i b) {
+#if defined(__SSE4_2__)
+    return _mm_cmpgt_epi64(a, b);
+#else
+    __m128i flip = _mm_set_epi32(0, static_cast<int>(0x80000000u), 0,
+        static_cast<int>(0x80000000u));
+    __m128i high = _mm_cmpgt_epi32(a, b);
+    __m128i low = _mm_cmpgt_epi32(_mm_xor_si128(a, flip),
+        _mm_xor_si128(b, flip));
+    __m128i greater = _mm_or_si128(high, _mm_and_si128(_mm_cmpeq_epi32(a, b),
+        _mm_slli_epi64(low, 32)));
+
+    // The answer is in the high half of each lane
+    return _mm_shuffle_epi32(greater, _MM_SHUFFLE(3, 3, 1, 1));
+#endif
+}
+
+template <class T>
+inline int simdRank(const T* keys, int size, T key,
+    std::integral_constant<int, 3>) {
+    int i = 0, rank = 0;
+
+#if defined(__AVX2__)
+    __m256i wide_key = _mm256_set1_epi64x(static_cast<long long>(key));
+    for (; i + 4 <= size; i += 4) {
+        __m256i values = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i*>(keys + i));
+        rank += popCount(_mm256_movemask_pd(_mm256_castsi256_pd(
+            _mm256_cmpgt_epi64(wide_key, values))));
+    }
+#endif
+
+    __m128i pattern = _mm_set1_epi64x(static_cast<long long>(key));
+    for (; i + 2 <= size; i += 2) {
+        __m128i values = _mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(keys + i));
+        rank += popCount(_mm_movemask_pd(_mm_castsi128_pd(
+            greaterThan64(pattern, values))));
+    }
+
+    for (; i < size; ++i) {
+        rank += keys[i] < key;
+    }
+
+    return rank;
+}
+
+template <class T>
+inline int simdRank(const T* keys, int size, T key,
+    std::integral_constant<int, 4>) {
+    int i = 0, rank = 0;
+    const long long sign = static_cast<long long>(0x8000000000000000ull);
+
+#if defined(__AVX2__)
+    __m256i wide_sign = _mm256_set1_epi64x(sign);
+    __m256i wide_key = _mm256_xor_si256(_mm256_set1_epi64x(
+        static_cast<long long>(key)), wide_sign);
+    for (; i + 4 <= size; i += 4) {
+        __m256i values = _mm256_xor_si256(_mm256_loadu_si256(
+            reinterpret_cast<const __m256i*>(keys + i)), wide_sign);
+        rank += popCount(_mm256_movemask_pd(_mm256_castsi256_pd(
+            _mm256_cmpgt_epi64(wide_key, values))));
+    }
+#endif
+
+    __m128i flip = _mm_set1_epi64x(sign);
+    __m128i pattern = _mm_xor_si128(_mm_set1_epi64x(
+        static_cast<long long>(key)), flip);
+    for (; i + 2 <= size; i += 2) {
+        __m128i values = _mm_xor_si128(_mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(keys + i)), flip);
+        rank += popCount(_mm_movemask_pd(_mm_castsi128_pd(
+            greaterThan64(pattern, values))));
+    }
+
+    for (; i < size; ++i) {
+        rank += keys[i] < key;
+    }
+
+    return rank;
+}
+
+template <class T>
+inline int simdRank(const T* keys, int size, T key,
+    std::integral_constant<int, 5>) {
+    int i = 0, rank = 0;
+
+#if defined(__AVX2__)
+    __m256 wide_key = _mm256_set1_ps(key);
+    for (; i + 8 <= size; i += 8) {
+        rank += popCount(_mm256_movemask_ps(_mm256_cmp_ps(
+            _mm256_loadu_ps(keys + i), wide_key, _CMP_LT_OQ)));
+    }
+#endif
+
+    __m128 pattern = _mm_set1_ps(key);
+    for (; i + 4 <= size; i += 4) {
+        rank += popCount(_mm_movemask_ps(_mm_cmplt_ps(
+            _mm_loadu_ps(keys + i), pattern)));
+    }
+
+    for (; i < size; ++i) {
+        rank += keys[i] < key;
+    }
+
+    return rank;
+}
+
+template <class T>
+inline int simdRank(const T* keys, int size, T key,
+    std::integral_constant<int, 6>) {
+    int i = 0, rank = 0;
+
+#if defined(__AVX2__)
+    __m256d wide_key = _mm256_set1_pd(key);
+    for (; i + 4 <= size; i += 4) {
+        rank += popCount(_mm256_movemask_pd(_mm256_cmp_pd(
+            _mm256_loadu_pd(keys + i), wide_key, _CMP_LT_OQ)));
+    }
+#endif
+
+    __m128d pattern = _mm_set1_pd(key);
+    for (; i + 2 <= size; i += 2) {
+        rank += popCount(_mm_movemask_pd(_mm_cmplt_pd(
+            _mm_loadu_pd(keys + i), pattern)));
+    }
+
+    for (; i < size; ++i) {
+        rank += keys[i] < key;
+    }
+
+    return rank;
+}
+#endif  // __SSE2__
+
+template <class T>
+struct BlockSearch<T, DefaulComparator<T>,
+    typename std::enable_if<std::is_arithmetic<T>::value>::type> {
+    static int rank(const T* keys, int size, const T& key,
+        DefaulComparator<T>&) {
+        return simdRank(keys, size, key,
+            std::integral_constant<int, SimdKind<T>::value>());
+    }
+};
+
+template <class T, class Comparator, class Policy>
+class BlockSkipList {
+    typedef Node<Block<T> > BlockNode;
+
+    int level_;
+    int num_elem_;
+    int num_keys_;
+    int index_path_[Policy::kMaxHeight];
+    BlockNode *path_[Policy::kMaxHeight], *head_;
+    NodePool<Block<T> > pool_;
+    Comparator comp_;
+    typename Policy::random_type new_rand_;
+
+ public:
+    BlockSkipList();
+    ~BlockSkipList();
+
+    BlockSkipList(const BlockSkipList<T, Comparator, Policy>&) = delete;
+    BlockSkipList<T, Comparator, Policy>&
+    operator=(const BlockSkipList<T, Comparator, Policy>&) = delete;
+
+    class iterator {
+        BlockNode *itr;
+        int pos;
+
+     public:
+        iterator();
+        iterator(BlockNode*, int);
+        iterator(const iterator&);
+
+        iterator& operator=(const iterator&);
+        bool operator==(const iterator&);
+        bool operator!=(const iterator&);
+        iterator& operator++();
+        const T& operator*();
+        int count();
+    };
+
+    iterator begin();
+    iterator end();
+    iterator findKey(const T&);
+
+    int size();
+    int length();
+    bool isEmpty();
+
+    int countKey(const T&);
+    bool searchKey(const T&);
+    void insertKey(const T&, int count_ = 1);
+    void eraseKey(const T&, int count_ = 1);
+
+    const T& topKey();
+    const T& operator[](int index);
+
+ private:
+    BlockNode* findLeaf(const T&);
+    BlockNode* findBlock(const T&);
+    void splitBlock(BlockNode*);
+    void unlinkBlock(BlockNode*, const T&);
+    int rankInBlock(BlockNode*, const T&);
+    int getNewHeight();
+};
+
+/*
+ * Implementation:
+ */
+
+template <class T, class Comparator, class Policy>
+BlockSkipList<T, Comparator, Policy> :: iterator ::
+iterator(): itr(nullptr), pos(0) {}
+
+template <class T, class Comparator, class Policy>
+BlockSkipList<T, Comparator, Policy> :: iterator ::
+iterator(BlockNode* other_itr, int other_pos): itr(other_itr),
+    pos(other_pos) {}
+
+template <class T, class Comparator, class Policy>
+BlockSkipList<T, Comparator, Policy> :: iterator ::
+iterator(const iterator& other): itr(other.itr), pos(other.pos) {}
+
+template <class T, class Comparator, class Policy>
+typename BlockSkipList<T, Comparator, Policy> :: iterator&
+BlockSkipList<T, Comparator, Policy> :: iterator ::
+operator=(const iterator& other) {
+    itr = other.itr;
+    pos = other.pos;
+    return *this;
+}
+
+template <class T, class Comparator, class Policy>
+bool
+BlockSkipList<T, Comparator, Policy> :: iterator ::
+operator== (const iterator& other) {
+    return itr == other.itr && pos == other.pos;
+}
+
+template <class T, class Comparator, class Policy>
+bool
+BlockSkipList<T, Comparator, Policy> :: iterator ::
+operator!= (const iterator& other) {
+    return !(*this == other);
+}
+
+template <class T, class Comparator, class Policy>
+typename BlockSkipList<T, Comparator, Policy> :: iterator&
+BlockSkipList<T, Comparator, Policy> :: iterator ::
+operator++() {
+    if (++pos == itr->count_) {
+        itr = itr->next(0);
+        pos = 0;
+    }
+
+    return *this;
+}
+
+template <class T, class Comparator, class Policy>
+const T&
+BlockSkipList<T, Comparator, Policy> :: iterator ::
+operator*() {
+    return itr->data_.keys_[pos];
+}
+
+template <class T, class Comparator, class Policy>
+int
+BlockSkipList<T, Comparator, Policy> :: iterator ::
+count() {
+    return itr->data_.counts_[pos];
+}
+
+template <class T, class Comparator, class Policy>
+BlockSkipList<T, Comparator, Policy> :: BlockSkipList(): level_(1),
+    num_elem_(0), num_keys_(0), head_(nullptr), comp_(), new_rand_() {
+    unsigned int seed = static_cast<unsigned int>(time(nullptr));
+
+    try {
+        head_ = pool_.newNode(Policy::kMaxHeight, 0);
+    } catch (std::exception& e) {
+        std::cerr << "Standard exception: " << e.what() << '\n';
+    }
+
+    new_rand_.seed(seed);
+}
+
+template <class T, class Comparator, class Policy>
+BlockSkipList<T, Comparator, Policy> :: ~BlockSkipList() {
+    BlockNode* tmp;
+
+    while (!std::is_trivially_destructible<T>::value && head_) {
+        tmp = head_;
+        head_ = head_->next(0);
+        tmp->~BlockNode();
+    }
+}
+
+template <class T, class Comparator, class Policy>
+typename BlockSkipList<T, Comparator, Policy> :: iterator
+BlockSkipList<T, Comparator, Policy> :: begin() {
+    return iterator(head_->next(0), 0);
+}
+
+template <class T, class Comparator, class Policy>
+typename BlockSkipList<T, Comparator, Policy> :: iterator
+BlockSkipList<T, Comparator, Policy> :: end() {
+    return iterator(nullptr, 0);
+}
+
+/*
+ * Search for key in skip list and return an iterator to its
+ * position or end iterator otherwise.
+ * O(logn)
+ */
+template <class T, class Comparator, class Policy>
+typename BlockSkipList<T, Comparator, Policy> :: iterator
+BlockSkipList<T, Comparator, Policy> :: findKey(const T& key) {
+    BlockNode *node = findLeaf(key);
+    int pos;
+
+    if (!node) {
+        return end();
+    }
+
+    pos = rankInBlock(node, key);
+    if (pos == node->count_ || key != node->data_.keys_[pos]) {
+        return end();
+    } else {
+        return iterator(node, pos);
+    }
+}
+
+template <class T, class Comparator, class Policy>
+int
+BlockSkipList<T, Comparator, Policy> :: size() {
+    return num_elem_;
+}
+
+template <class T, class Comparator, class Policy>
+int
+BlockSkipList<T, Comparator, Policy> :: length() {
+    return num_keys_;
+}
+
+template <class T, class Comparator, class Policy>
+bool
+BlockSkipList<T, Comparator, Policy> :: isEmpty() {
+    return num_keys_ == 0;
+}
+
+/*
+ * Search for key in skip list and returns how many
+ * times the key is on the skip list.
+ * O(logn)
+ */
+template <class T, class Comparator, class Policy>
+int
+BlockSkipList<T, Comparator, Policy> :: countKey(const T& key) {
+    iterator it = findKey(key);
+
+    return (it == end())? 0: it.count();
+}
+
+template <class T, class Comparator, class Policy>
+bool
+BlockSkipList<T, Comparator, Policy> :: searchKey(const T& key) {
+    return countKey(key);
+}
+
+/*
+ * Insert count keys in the skip list (count = 1 default).
+ * A new key goes in the block found by the search, which is split
+ * first if it is full.
+ * O(logn)
+ */
+template <class T, class Comparator, class Policy>
+void
+BlockSkipList<T, Comparator, Policy> :: insertKey(const T& key, int count) {
+    try {
+        if (count < 1) {
+            throw 1;
+        }
+    } catch (...) {
+        std::cerr << "Standard exception: insertKey negative number of keys\n";
+        return;
+    }
+
+    BlockNode *node;
+    Block<T> *block;
+    int pos;
+
+    while (true) {
+        node = findBlock(key);
+
+        if (node == head_) {
+            // Empty list: a block with the key, at least as tall as the list
+            node = pool_.newNode(getNewHeight(), 1);
+            node->data_.keys_[0] = key;
+            node->data_.counts_[0] = count;
+
+            for (; level_ < node->height_; ++level_) {
+                head_->span(level_) = 0;
+            }
+
+            for (int i = 0; i < level_; ++i) {
+                if (i < node->height_) {
+                    head_->next(i) = node;
+                    head_->span(i) = 0;
+                } else {
+                    head_->span(i) = 1;
+                }
+            }
+
+            num_elem_ += count;
+            ++num_keys_;
+            return;
+        }
+
+        block = &node->data_;
+        pos = rankInBlock(node, key);
+
+        if (pos < node->count_ && !(key != block->keys_[pos])) {
+            block->counts_[pos] += count;
+            num_elem_ += count;
+            return;
+        }
+
+        if (node->count_ < Block<T>::kKeys) {
+            for (int i = node->count_; i > pos; --i) {
+                block->keys_[i] = block->keys_[i - 1];
+                block->counts_[i] = block->counts_[i - 1];
+            }
+
+            block->keys_[pos] = key;
+            block->counts_[pos] = count;
+            ++node->count_;
+
+            // The levels above the block skip over one more key
+            for (int i = node->height_; i < level_; ++i) {
+                ++path_[i]->span(i);
+            }
+
+            num_elem_ += count;
+            ++num_keys_;
+            return;
+        }
+
+        splitBlock(node);
+    }
+}
+
+/*
+ * Erase count keys from the skip list (count = 1 default).
+ * O(logn)
+ */
+template <class T, class Comparator, class Policy>
+void
+BlockSkipList<T, Comparator, Policy> :: eraseKey(const T& key, int count) {
+    try {
+        if (count < 1) {
+            throw 1;
+        }
+    } catch (...) {
+        std::cerr << "Standard exception: eraseKey negative number of keys\n";
+        return;
+    }
+
+    BlockNode *node = findBlock(key);
+    Block<T> *block = &node->data_;
+    int pos;
+
+    if (node == head_) {
+        return;
+    }
+
+    pos = rankInBlock(node, key);
+    if (pos == node->count_ || key != block->keys_[pos]) {
+        return;
+    }
+
+    if (block->counts_[pos] > count) {
+        block->counts_[pos] -= count;
+        num_elem_ -= count;
+        return;
+    }
+
+    num_elem_ -= block->counts_[pos];
+    --num_keys_;
+
+    if (node->count_ == 1) {
+        unlinkBlock(node, key);
+        return;
+    }
+
+    for (int i = pos + 1; i < node->count_; ++i) {
+        block->keys_[i - 1] = block->keys_[i];
+        block->counts_[i - 1] = block->counts_[i];
+    }
+    --node->count_;
+
+    for (int i = node->height_; i < level_; ++i) {
+        --path_[i]->span(i);
+    }
+}
+
+template <class T, class Comparator, class Policy>
+const T&
+BlockSkipList<T, Comparator, Policy> :: topKey() {
+    try {
+        if (num_keys_ < 1) {
+            throw 1;
+        }
+    } catch (...) {
+        std::cerr << "Standard exception: empty list\n";
+    }
+
+    return head_->next(0)->data_.keys_[0];
+}
+
+/*
+ * Return date from position index in skip list (distinct keys).
+ * O(logn)
+ */
+template <class T, class Comparator, class Policy>
+const T&
+BlockSkipList<T, Comparator, Policy> :: operator[](int index) {
+    try {
+        if (index < 0 || num_keys_ <= index) {
+            throw 1;
+        }
+    } catch (...) {
+        std::cerr << "Standard exception: index outside the bounds\n";
+    }
+
+    BlockNode *next, *it = head_;
+    int curr_index = 0;
+
+    // curr_index is the position of the first key of it
+    for (int i = level_ - 1; i > -1; --i) {
+        while ((next = it->next(i)) &&
+            curr_index + it->count_ + it->span(i) <= index) {
+            curr_index += it->count_ + it->span(i);
+            it = next;
+        }
+    }
+
+    return it->data_.keys_[index - curr_index];
+}
+
+/*
+ * The block where key is or would be, without touching the path.
+ */
+template <class T, class Comparator, class Policy>
+typename BlockSkipList<T, Comparator, Policy> :: BlockNode*
+BlockSkipList<T, Comparator, Policy> :: findLeaf(const T& key) {
+    BlockNode *next, *it = head_;
+
+    for (int i = level_ - 1; i > -1; --i) {
+        while ((next = it->next(i)) && !comp_(next->data_.keys_[0], key)) {
+            it = next;
+        }
+    }
+
+    return (it == head_)? head_->next(0): it;
+}
+
+/*
+ * Fill path / index_path: for each level the last block that starts before
+ * or at key and the number of keys before it. Return the block where key is
+ * or would be (the first one for a key before all, head if empty); the
+ * levels of that block point to itself in the path.
+ */
+template <class T, class Comparator, class Policy>
+typename BlockSkipList<T, Comparator, Policy> :: BlockNode*
+BlockSkipList<T, Comparator, Policy> :: findBlock(const T& key) {
+    BlockNode *next, *it = head_;
+    int curr_index = 0;
+
+    for (int i = level_ - 1; i > -1; --i) {
+        while ((next = it->next(i)) && !comp_(next->data_.keys_[0], key)) {
+            curr_index += it->count_ + it->span(i);
+            it = next;
+        }
+
+        index_path_[i] = curr_index;
+        path_[i] = it;
+    }
+
+    if (it == head_ && head_->next(0)) {
+        it = head_->next(0);
+
+        for (int i = 0; i < it->height_; ++i) {
+            index_path_[i] = 0;
+            path_[i] = it;
+        }
+    }
+
+    return it;
+}
+
+/*
+ * Move the upper half of a full block in a new block linked right after it.
+ * The path must be the one of findBlock. Every level keeps the same end of
+ * its link (end), only the keys are redistributed between the links.
+ */
+template <class T, class Comparator, class Policy>
+void
+BlockSkipList<T, Comparator, Policy> :: splitBlock(BlockNode* node) {
+    const int half = Block<T>::kKeys / 2;
+    int end[Policy::kMaxHeight], new_index;
+    BlockNode *other = pool_.newNode(getNewHeight(), Block<T>::kKeys - half);
+
+    for (int i = half; i < Block<T>::kKeys; ++i) {
+        other->data_.keys_[i - half] = node->data_.keys_[i];
+        other->data_.counts_[i - half] = node->data_.counts_[i];
+    }
+
+    // New levels start empty: from the head straight to the end
+    for (; level_ < other->height_; ++level_) {
+        path_[level_] = head_;
+        index_path_[level_] = 0;
+        head_->span(level_) = num_keys_;
+    }
+
+    for (int i = 0; i < level_; ++i) {
+        end[i] = index_path_[i] + path_[i]->count_ + path_[i]->span(i);
+    }
+
+    node->count_ = half;
+    new_index = index_path_[0] + half;
+
+    for (int i = 0; i < level_; ++i) {
+        if (i < other->height_) {
+            other->next(i) = path_[i]->next(i);
+            path_[i]->next(i) = other;
+            path_[i]->span(i) = new_index - index_path_[i] - path_[i]->count_;
+            other->span(i) = end[i] - new_index - other->count_;
+        } else {
+            path_[i]->span(i) = end[i] - index_path_[i] - path_[i]->count_;
+        }
+    }
+}
+
+/*
+ * Unlink a block that just lost its last key. The path of findBlock ends
+ * on the block itself, so the nodes right before it are searched again.
+ */
+template <class T, class Comparator, class Policy>
+void
+BlockSkipList<T, Comparator, Policy> :: unlinkBlock(BlockNode* node,
+    const T& key) {
+    BlockNode *next, *it = head_;
+
+    for (int i = level_ - 1; i > -1; --i) {
+        while ((next = it->next(i)) && next != node &&
+            !comp_(next->data_.keys_[0], key)) {
+            it = next;
+        }
+
+        if (i < node->height_) {
+            it->next(i) = node->next(i);
+            it->span(i) += node->span(i);
+        } else {
+            --it->span(i);
+        }
+    }
+
+    pool_.deleteNode(node);
+
+    // Drop the levels left empty
+    while (level_ > 1 && !head_->next(level_ - 1)) {
+        --level_;
+    }
+}
+
+template <class T, class Comparator, class Policy>
+int
+BlockSkipList<T, Comparator, Policy> :: rankInBlock(BlockNode* node,
+    const T& key) {
+    return BlockSearch<T, Comparator>::rank(node->data_.keys_, node->count_,
+        key, comp_);
+}
+
+/*
+ * Each new level is taken with probability p = PromoteNum / PromoteDen.
+ */
+template <class T, class Comparator, class Policy>
+int
+BlockSkipList<T, Comparator, Policy> :: getNewHeight() {
+    return Policy::newHeight(new_rand_);
+}
+
+#endif  // BLOCK_SKIP_LIST_H_
@@ -0,0 +1,342 @@
+// Copyright 2019 Nedelcu Horia (nedelcu.horia.alexandru@gmail.com)
+
+/**
+*    Compact Treap Implementation:
+*
+*    Same treap as Treap (binary search tree on keys, max-heap on
+* priorities, nr_nodes kept for findK), but every node lives in one
+* contiguous pool and the children are 32 bit indices in it. Index 0 is
+* the only nil node, shared by all the leaves (size 0, priority 0), so n
+* keys take n nodes instead of n nodes + 2n nil objects, and a search
+* walks an array instead of scattered heap objects. Erased nodes are kept
+* on a free list (linked through left) and reused by the next insertions.
+*    Priorities are taken from a xorshift generator (or given by the
+* caller, > 0). Equal keys are allowed, like in Treap.
+*/
+
+#ifndef COMPACT_TREAP_H_
+#define COMPACT_TREAP_H_
+
+#include <ctime>
+#include <vector>
+#include <cstdint>
+#include <iostream>
+
+#define TREAP_NIL 0
+
+template <class T>
+struct CompactTreapNode {
+    T key;
+    uint32_t priority;
+    uint32_t left, right;
+    uint32_t nr_nodes;
+};
+
+template <class T>
+class CompactTreap {
+    std::vector<CompactTreapNode<T> > nodes_;
+    uint32_t root_;
+    uint32_t free_;
+    uint32_t rand_;
+
+ public:
+    CompactTreap();
+
+    int size();
+    bool isEmpty();
+    void reserve(int);
+    void clear();
+
+    bool find(const T&);
+    void insert(const T&);
+    void insert(const T&, uint32_t priority);
+    void erase(const T&);
+    const T& findK(int k);
+
+ private:
+    uint32_t newNode(const T&, uint32_t);
+    void deleteNode(uint32_t);
+    uint32_t insertNode(uint32_t, uint32_t);
+    uint32_t eraseNode(uint32_t, const T&);
+    uint32_t rotateRight(uint32_t);
+    uint32_t rotateLeft(uint32_t);
+    void update(uint32_t);
+    uint32_t getPriority();
+};
+
+/*
+ * Implementation:
+ */
+
+template <class T>
+CompactTreap<T> :: CompactTreap(): root_(TREAP_NIL), free_(TREAP_NIL),
+    rand_(static_cast<uint32_t>(time(nullptr)) | 1) {
+    nodes_.resize(1);
+    nodes_[TREAP_NIL].priority = 0;
+    nodes_[TREAP_NIL].left = nodes_[TREAP_NIL].right = TREAP_NIL;
+    nodes_[TREAP_NIL].nr_nodes = 0;
+}
+
+template <class T>
+int
+CompactTreap<T> :: size() {
+    return nodes_[root_].nr_nodes;
+}
+
+template <class T>
+bool
+CompactTreap<T> :: isEmpty() {
+    return root_ == TREAP_NIL;
+}
+
+/*
+ * Make room for n keys, so that the pool doesn't grow while inserting.
+ */
+template <class T>
+void
+CompactTreap<T> :: reserve(int n) {
+    nodes_.reserve(n + 1);
+}
+
+/*
+ * Erase all the keys, the pool keeps its memory.
+ * O(1)
+ */
+template <class T>
+void
+CompactTreap<T> :: clear() {
+    nodes_.resize(1);
+    root_ = TREAP_NIL;
+    free_ = TREAP_NIL;
+}
+
+/*
+ * O(logn)
+ */
+template <class T>
+bool
+CompactTreap<T> :: find(const T& key) {
+    uint32_t it = root_;
+
+    while (it != TREAP_NIL) {
+        const CompactTreapNode<T>& node = nodes_[it];
+
+        if (node.key == key) {
+            return true;
+        }
+
+        it = (node.key < key)? node.right: node.left;
+    }
+
+    return false;
+}
+
+/*
+ * O(logn)
+ */
+template <class T>
+void
+CompactTreap<T> :: insert(const T& key) {
+    insert(key, getPriority());
+}
+
+/*
+ * The node is taken from the pool first, so the pool doesn't move during
+ * the descent.
+ * O(logn)
+ */
+template <class T>
+void
+CompactTreap<T> :: insert(const T& key, uint32_t priority) {
+    root_ = insertNode(root_, newNode(key, priority? priority: 1));
+}
+
+/*
+ * Erase one copy of key.
+ * O(logn)
+ */
+template <class T>
+void
+CompactTreap<T> :: erase(const T& key) {
+    root_ = eraseNode(root_, key);
+}
+
+/*
+ * The k-th key in order (1 <= k <= size).
+ * O(logn)
+ */
+template <class T>
+const T&
+CompactTreap<T> :: findK(int k) {
+    try {
+        if (k < 1 || size() < k) {
+            throw 1;
+        }
+    } catch (...) {
+        std::cerr << "Standard exception: index outside the bounds\n";
+    }
+
+    uint32_t it = root_;
+    int left;
+
+    while (it != TREAP_NIL) {
+        left = nodes_[nodes_[it].left].nr_nodes;
+
+        if (k == left + 1) {
+            break;
+        } else if (k > left + 1) {
+            k -= left + 1;
+            it = nodes_[it].right;
+        } else {
+            it = nodes_[it].left;
+        }
+    }
+
+    return nodes_[it].key;
+}
+
+template <class T>
+uint32_t
+CompactTreap<T> :: newNode(const T& key, uint32_t priority) {
+    uint32_t index;
+
+    if (free_ != TREAP_NIL) {
+        index = free_;
+        free_ = nodes_[index].left;
+    } else {
+        index = static_cast<uint32_t>(nodes_.size());
+        nodes_.push_back(CompactTreapNode<T>());
+    }
+
+    CompactTreapNode<T>& node = nodes_[index];
+    node.key = key;
+    node.priority = priority;
+    node.left = node.right = TREAP_NIL;
+    node.nr_nodes = 1;
+
+    return index;
+}
+
+template <class T>
+void
+CompactTreap<T> :: deleteNode(uint32_t index) {
+    nodes_[index].left = free_;
+    free_ = index;
+}
+
+/*
+ * Insert node in the subtree of f and return the new root of the subtree.
+ */
+template <class T>
+uint32_t
+CompactTreap<T> :: insertNode(uint32_t f, uint32_t node) {
+    if (f == TREAP_NIL) {
+        return node;
+    }
+
+    if (nodes_[node].key < nodes_[f].key) {
+        nodes_[f].left = insertNode(nodes_[f].left, node);
+
+        if (nodes_[nodes_[f].left].priority > nodes_[f].priority) {
+            return rotateRight(f);
+        }
+    } else {
+        nodes_[f].right = insertNode(nodes_[f].right, node);
+
+        if (nodes_[nodes_[f].right].priority > nodes_[f].priority) {
+            return rotateLeft(f);
+        }
+    }
+
+    update(f);
+    return f;
+}
+
+/*
+ * The node of key goes down (rotated with the child of higher priority)
+ * until it is a leaf, then it is cut.
+ */
+template <class T>
+uint32_t
+CompactTreap<T> :: eraseNode(uint32_t f, const T& key) {
+    uint32_t left, right;
+
+    if (f == TREAP_NIL) {
+        return f;
+    }
+
+    if (key < nodes_[f].key) {
+        nodes_[f].left = eraseNode(nodes_[f].left, key);
+    } else if (nodes_[f].key < key) {
+        nodes_[f].right = eraseNode(nodes_[f].right, key);
+    } else {
+        left = nodes_[f].left;
+        right = nodes_[f].right;
+
+        if (left == TREAP_NIL && right == TREAP_NIL) {
+            deleteNode(f);
+            return TREAP_NIL;
+        }
+
+        if (nodes_[left].priority > nodes_[right].priority) {
+            f = rotateRight(f);
+            nodes_[f].right = eraseNode(nodes_[f].right, key);
+        } else {
+            f = rotateLeft(f);
+            nodes_[f].left = eraseNode(nodes_[f].left, key);
+        }
+    }
+
+    update(f);
+    return f;
+}
+
+template <class T>
+uint32_t
+CompactTreap<T> :: rotateRight(uint32_t f) {
+    uint32_t l = nodes_[f].left;
+
+    nodes_[f].left = nodes_[l].right;
+    nodes_[l].right = f;
+
+    update(f);
+    update(l);
+
+    return l;
+}
+
+template <class T>
+uint32_t
+CompactTreap<T> :: rotateLeft(uint32_t f) {
+    uint32_t r = nodes_[f].right;
+
+    nodes_[f].right = nodes_[r].left;
+    nodes_[r].left = f;
+
+    update(f);
+    update(r);
+
+    return r;
+}
+
+template <class T>
+void
+CompactTreap<T> :: update(uint32_t f) {
+    nodes_[f].nr_nodes = nodes_[nodes_[f].left].nr_nodes
+        + nodes_[nodes_[f].right].nr_nodes + 1;
+}
+
+/*
+ * xorshift32, never 0 (0 is the priority of nil).
+ */
+template <class T>
+uint32_t
+CompactTreap<T> :: getPriority() {
+    rand_ ^= rand_ << 13;
+    rand_ ^= rand_ >> 17;
+    rand_ ^= rand_ << 5;
+
+    return rand_;
+}
+
+#endif  // COMPACT_TREAP_H_
@@ -0,0 +1,831 @@
+// Copyright 2019 Nedelcu Horia (nedelcu.horia.alexandru@gmail.com)
+
+/**
+*    Concurrent SkipList Implementation:
+*
+*    Thread-safe variant of SkipList built as a lazy skip list. The readers
+* (findKey, countKey, searchKey) never take a lock: they go down the towers
+* with acquire loads and only look at the flags of the node they land on.
+* The writers lock just the predecessors of the key they change, so updates
+* on different parts of the list run in parallel.
+*    Duplicates are kept like in SkipList: each node keeps the number of
+* times its key appears (count). Changing the count of an existing key is a
+* CAS on that counter and the thread whose CAS takes it to zero is the only
+* one that unlinks the node. Unlinked nodes can still be visited by readers,
+* so they are retired and freed by epochs (see EpochDomain): every call and
+* every iterator holds a guard, and a node is freed once the guards that
+* were open when it was unlinked are closed. An iterator kept for a long
+* time holds back the nodes unlinked after it was taken.
+*    Each call keeps its path (preds / succs) on its own stack, there are no
+* shared scratch vectors. The ranks (jump) are not maintained here, so this
+* variant has no operator[].
+*/
+
+#ifndef CONCURRENT_SKIP_LIST_H_
+#define CONCURRENT_SKIP_LIST_H_
+
+#include <ctime>
+#include <mutex>
+#include <atomic>
+#include <random>
+#include <thread>
+#include <cstdint>
+#include <iostream>
+#include <functional>
+
+#include "SkipList.h"
+
+#define EPOCH_STRIPES 16
+#define EPOCH_STRIPE_ALIGN 64
+#define EPOCH_RETIRE_BATCH 64
+
+template <class T> class ConcurrentNode;
+template <class T> class EpochDomain;
+template <class T, class Comparator = DefaulComparator<T> >
+class ConcurrentSkipList;
+
+template <class T>
+class ConcurrentNode {
+ public:
+    T data_;
+    int height_;
+    std::atomic<int> count_;
+    std::atomic<bool> marked_;
+    std::atomic<bool> fully_linked_;
+    std::atomic<ConcurrentNode<T>*> *next_;
+    ConcurrentNode<T> *retired_next_;
+    std::mutex lock_;
+
+    ConcurrentNode(const T&, int, int count_ = 1);
+    ~ConcurrentNode();
+
+    ConcurrentNode(const ConcurrentNode<T>&) = delete;
+    ConcurrentNode& operator=(const ConcurrentNode<T>&) = delete;
+};
+
+/*
+ * Epoch based reclamation of the nodes of a ConcurrentSkipList. A guard
+ * announces the global epoch it saw in a reader counter (one for each
+ * epoch mod 3, spread over stripes so threads don't share one counter). A
+ * node unlinked in epoch e goes on the retired list of e. The epoch goes
+ * from e to e + 1 only when no guard of e - 1 is left, and then the nodes
+ * retired in e - 1 are freed: a guard that can still reach them was taken
+ * before they were unlinked, so in e - 1 or earlier. Every
+ * EPOCH_RETIRE_BATCH retired nodes the epoch is moved on, so about
+ * 3 * EPOCH_RETIRE_BATCH retired nodes wait, plus the ones held back by
+ * guards still open. Each stripe takes a cache line of its own, which makes
+ * the domain (and a list holding it) over-aligned: from the heap only
+ * C++17 new honours that, earlier ones may start a stripe mid-line.
+ */
+template <class T>
+class EpochDomain {
+    struct alignas(EPOCH_STRIPE_ALIGN) Stripe {
+        std::atomic<int> readers_[3];
+    };
+
+    std::atomic<uint64_t> epoch_;
+    std::atomic<int> pending_;
+    std::atomic<ConcurrentNode<T>*> retired_[3];
+    alignas(EPOCH_STRIPE_ALIGN) Stripe stripes_[EPOCH_STRIPES];
+
+ public:
+    /*
+     * The nodes reached while a guard is alive stay valid. A copy holds
+     * the same epoch (it may outlive the original).
+     */
+    class Guard {
+        EpochDomain<T> *domain;
+        uint64_t epoch;
+        int stripe;
+
+     public:
+        Guard();
+        explicit Guard(EpochDomain<T>*);
+        Guard(const Guard&);
+        ~Guard();
+
+        Guard& operator=(const Guard&);
+    };
+
+    EpochDomain();
+    ~EpochDomain();
+
+    EpochDomain(const EpochDomain<T>&) = delete;
+    EpochDomain<T>& operator=(const EpochDomain<T>&) = delete;
+
+    void retire(ConcurrentNode<T>*);
+    bool advance();
+
+ private:
+    static void freeList(ConcurrentNode<T>*);
+    static int threadStripe();
+};
+
+template <class T, class Comparator>
+class ConcurrentSkipList {
+    template <class U, class C> friend class SprayList;
+    typedef typename EpochDomain<T>::Guard Guard;
+
+    std::atomic<int> num_elem_;
+    std::atomic<int> num_nodes_;
+    ConcurrentNode<T> *head_;
+    EpochDomain<T> epochs_;
+    Comparator comp_;
+
+ public:
+    ConcurrentSkipList();
+    ~ConcurrentSkipList();
+
+    ConcurrentSkipList(const ConcurrentSkipList<T, Comparator>&) = delete;
+    ConcurrentSkipList<T, Comparator>&
+    operator=(const ConcurrentSkipList<T, Comparator>&) = delete;
+
+    /*
+     * Weakly consistent iterator: it sees every key present for the whole
+     * traversal and may or may not see keys changed meanwhile. It holds a
+     * guard, so the node it is on isn't freed under it.
+     */
+    class iterator {
+        ConcurrentNode<T>* itr;
+        Guard guard;
+
+     public:
+        iterator();
+        iterator(ConcurrentNode<T>*, const Guard&);
+        iterator(const iterator&);
+
+        iterator& operator=(const iterator&);
+        bool operator==(const iterator&);
+        bool operator!=(const iterator&);
+        iterator& operator++();
+        const T& operator*();
+    };
+
+    iterator begin();
+    iterator end();
+    iterator findKey(const T&);
+
+    int size();
+    int length();
+    bool isEmpty();
+
+    int countKey(const T&);
+    bool searchKey(const T&);
+    void insertKey(const T&, int count_ = 1);
+    void eraseKey(const T&, int count_ = 1);
+
+    void reclaim();
+
+ private:
+    ConcurrentNode<T>* lookup(const T&);
+    int findPath(const T&, ConcurrentNode<T>**, ConcurrentNode<T>**);
+    int takeCount(ConcurrentNode<T>*, int);
+    void unlockPath(ConcurrentNode<T>**, int);
+    void retire(ConcurrentNode<T>*);
+    static ConcurrentNode<T>* skipMarked(ConcurrentNode<T>*);
+    static int getNewHeight();
+};
+
+/*
+ * Implementation:
+ */
+
+template <class T>
+ConcurrentNode<T> :: ConcurrentNode(const T& data, int height, int count):
+    data_(data), height_(height), count_(count), marked_(false),
+    fully_linked_(false), next_(nullptr), retired_next_(nullptr) {
+    try {
+        next_ = new std::atomic<ConcurrentNode<T>*>[height];
+
+        for (int i = 0; i < height; ++i) {
+            next_[i].store(nullptr, std::memory_order_relaxed);
+        }
+    } catch (std::exception& e) {
+        std::cerr << "Standard exception: " << e.what() << '\n';
+    }
+}
+
+template <class T>
+ConcurrentNode<T> :: ~ConcurrentNode() {
+    delete[] next_;
+}
+
+template <class T>
+EpochDomain<T> :: Guard :: Guard(): domain(nullptr), epoch(0), stripe(0) {}
+
+/*
+ * Count this guard in the epoch it read, then read the epoch again: if it
+ * moved meanwhile, the epoch may have been moved on without seeing this
+ * guard, so the guard is taken again in the new epoch.
+ */
+template <class T>
+EpochDomain<T> :: Guard :: Guard(EpochDomain<T>* other_domain):
+    domain(other_domain), epoch(0), stripe(threadStripe()) {
+    std::atomic<int> *readers = domain->stripes_[stripe].readers_;
+
+    while (true) {
+        epoch = domain->epoch_.load();
+        readers[epoch % 3].fetch_add(1);
+
+        if (domain->epoch_.load() == epoch) {
+            break;
+        }
+
+        readers[epoch % 3].fetch_sub(1);
+    }
+}
+
+/*
+ * The copy is counted on the same stripe before the original can leave,
+ * so the counter of the epoch doesn't drop to zero in between.
+ */
+template <class T>
+EpochDomain<T> :: Guard :: Guard(const Guard& other): domain(other.domain),
+    epoch(other.epoch), stripe(other.stripe) {
+    if (domain) {
+        domain->stripes_[stripe].readers_[epoch % 3].fetch_add(1);
+    }
+}
+
+template <class T>
+EpochDomain<T> :: Guard :: ~Guard() {
+    if (domain) {
+        domain->stripes_[stripe].readers_[epoch % 3].fetch_sub(1);
+    }
+}
+
+template <class T>
+typename EpochDomain<T> :: Guard&
+EpochDomain<T> :: Guard :: operator=(const Guard& other) {
+    if (other.domain) {
+        other.domain->stripes_[other.stripe].readers_[other.epoch % 3]
+            .fetch_add(1);
+    }
+    if (domain) {
+        domain->stripes_[stripe].readers_[epoch % 3].fetch_sub(1);
+    }
+
+    domain = other.domain;
+    epoch = other.epoch;
+    stripe = other.stripe;
+
+    return *this;
+}
+
+template <class T>
+EpochDomain<T> :: EpochDomain(): epoch_(0), pending_(0) {
+    for (int i = 0; i < 3; ++i) {
+        retired_[i].store(nullptr);
+
+        for (int j = 0; j < EPOCH_STRIPES; ++j) {
+            stripes_[j].readers_[i].store(0);
+        }
+    }
+}
+
+/*
+ * No guard is left when the domain goes.
+ */
+template <class T>
+EpochDomain<T> :: ~EpochDomain() {
+    for (int i = 0; i < 3; ++i) {
+        freeList(retired_[i].exchange(nullptr));
+    }
+}
+
+/*
+ * node is unlinked: no guard taken from now on can reach it.
+ * O(1) (O(EPOCH_RETIRE_BATCH) amortized for the frees)
+ */
+template <class T>
+void
+EpochDomain<T> :: retire(ConcurrentNode<T>* node) {
+    std::atomic<ConcurrentNode<T>*>& retired = retired_[epoch_.load() % 3];
+
+    node->retired_next_ = retired.load(std::memory_order_relaxed);
+    while (!retired.compare_exchange_weak(node->retired_next_, node)) {
+    }
+
+    // A guard may hold the epoch back: the next retires try again
+    if (pending_.fetch_add(1) + 1 >= EPOCH_RETIRE_BATCH && advance()) {
+        pending_.store(0);
+    }
+}
+
+/*
+ * Move the epoch from e to e + 1 if no guard of e - 1 is left and free
+ * the nodes retired in e - 1. Return false if some guard holds it back.
+ * O(EPOCH_STRIPES + nodes freed)
+ */
+template <class T>
+bool
+EpochDomain<T> :: advance() {
+    uint64_t epoch = epoch_.load();
+    int readers = 0;
+
+    for (int i = 0; i < EPOCH_STRIPES; ++i) {
+        readers += stripes_[i].readers_[(epoch + 2) % 3].load();
+    }
+
+    if (readers || !epoch_.compare_exchange_strong(epoch, epoch + 1)) {
+        return false;
+    }
+
+    freeList(retired_[(epoch + 2) % 3].exchange(nullptr));
+    return true;
+}
+
+template <class T>
+void
+EpochDomain<T> :: freeList(ConcurrentNode<T>* it) {
+    ConcurrentNode<T> *tmp;
+
+    while (it) {
+        tmp = it;
+        it = it->retired_next_;
+        delete tmp;
+    }
+}
+
+/*
+ * Threads take the stripes in turn.
+ */
+template <class T>
+int
+EpochDomain<T> :: threadStripe() {
+    static std::atomic<int> next_stripe(0);
+    static thread_local int stripe = next_stripe.fetch_add(1)
+        % EPOCH_STRIPES;
+
+    return stripe;
+}
+
+template <class T, class Comparator>
+ConcurrentSkipList<T, Comparator> :: iterator ::
+iterator(): itr(nullptr) {}
+
+template <class T, class Comparator>
+ConcurrentSkipList<T, Comparator> :: iterator ::
+iterator(ConcurrentNode<T>* other_itr, const Guard& other_guard):
+    itr(other_itr), guard(other_guard) {}
+
+template <class T, class Comparator>
+ConcurrentSkipList<T, Comparator> :: iterator ::
+iterator(const iterator& other): itr(other.itr), guard(other.guard) {}
+
+template <class T, class Comparator>
+typename ConcurrentSkipList<T, Comparator> :: iterator&
+ConcurrentSkipList<T, Comparator> :: iterator ::
+operator=(const iterator& other) {
+    itr = other.itr;
+    guard = other.guard;
+    return *this;
+}
+
+template <class T, class Comparator>
+bool
+ConcurrentSkipList<T, Comparator> :: iterator ::
+operator== (const iterator& other) {
+    return itr == other.itr;
+}
+
+template <class T, class Comparator>
+bool
+ConcurrentSkipList<T, Comparator> :: iterator ::
+operator!= (const iterator& other) {
+    return itr != other.itr;
+}
+
+template <class T, class Comparator>
+typename ConcurrentSkipList<T, Comparator> :: iterator&
+ConcurrentSkipList<T, Comparator> :: iterator ::
+operator++() {
+    itr = skipMarked(itr->next_[0].load(std::memory_order_acquire));
+    return *this;
+}
+
+template <class T, class Comparator>
+const T&
+ConcurrentSkipList<T, Comparator> :: iterator ::
+operator*() {
+    return itr->data_;
+}
+
+template <class T, class Comparator>
+ConcurrentSkipList<T, Comparator> :: ConcurrentSkipList(): num_elem_(0),
+    num_nodes_(0), head_(nullptr), comp_() {
+    T tmp = T();
+
+    try {
+        head_ = new ConcurrentNode<T>(tmp, H_MAX);
+        head_->fully_linked_.store(true);
+    } catch (std::exception& e) {
+        std::cerr << "Standard exception: " << e.what() << '\n';
+    }
+}
+
+template <class T, class Comparator>
+ConcurrentSkipList<T, Comparator> :: ~ConcurrentSkipList() {
+    ConcurrentNode<T>* tmp;
+
+    while (head_) {
+        tmp = head_;
+        head_ = head_->next_[0].load(std::memory_order_relaxed);
+        delete tmp;
+    }
+}
+
+template <class T, class Comparator>
+typename ConcurrentSkipList<T, Comparator> :: iterator
+ConcurrentSkipList<T, Comparator> :: begin() {
+    Guard guard(&epochs_);
+
+    return iterator(skipMarked(
+        head_->next_[0].load(std::memory_order_acquire)), guard);
+}
+
+template <class T, class Comparator>
+typename ConcurrentSkipList<T, Comparator> :: iterator
+ConcurrentSkipList<T, Comparator> :: end() {
+    return iterator();
+}
+
+/*
+ * Search for key in skip list and return an iterator to its
+ * position or end iterator otherwise. Lock-free.
+ * O(logn)
+ */
+template <class T, class Comparator>
+typename ConcurrentSkipList<T, Comparator> :: iterator
+ConcurrentSkipList<T, Comparator> :: findKey(const T& key) {
+    Guard guard(&epochs_);
+    ConcurrentNode<T> *node = lookup(key);
+
+    if (!node || node->marked_.load(std::memory_order_acquire) ||
+        !node->fully_linked_.load(std::memory_order_acquire)) {
+        return iterator();
+    } else {
+        return iterator(node, guard);
+    }
+}
+
+template <class T, class Comparator>
+int
+ConcurrentSkipList<T, Comparator> :: size() {
+    return num_elem_.load(std::memory_order_relaxed);
+}
+
+template <class T, class Comparator>
+int
+ConcurrentSkipList<T, Comparator> :: length() {
+    return num_nodes_.load(std::memory_order_relaxed);
+}
+
+template <class T, class Comparator>
+bool
+ConcurrentSkipList<T, Comparator> :: isEmpty() {
+    return length() == 0;
+}
+
+/*
+ * Search for key in skip list and returns how many
+ * times the key is on the skip list. Lock-free.
+ * O(logn)
+ */
+template <class T, class Comparator>
+int
+ConcurrentSkipList<T, Comparator> :: countKey(const T& key) {
+    Guard guard(&epochs_);
+    ConcurrentNode<T> *node = lookup(key);
+
+    if (!node || node->marked_.load(std::memory_order_acquire) ||
+        !node->fully_linked_.load(std::memory_order_acquire)) {
+        return 0;
+    } else {
+        return node->count_.load(std::memory_order_acquire);
+    }
+}
+
+template <class T, class Comparator>
+bool
+ConcurrentSkipList<T, Comparator> :: searchKey(const T& key) {
+    return countKey(key);
+}
+
+/*
+ * Insert count keys in the skip list (count = 1 default).
+ * If the key is already there only its counter is increased (CAS),
+ * otherwise the predecessors of the new node are locked and validated.
+ * O(logn)
+ */
+template <class T, class Comparator>
+void
+ConcurrentSkipList<T, Comparator> :: insertKey(const T& key, int count) {
+    try {
+        if (count < 1) {
+            throw 1;
+        }
+    } catch (...) {
+        std::cerr << "Standard exception: insertKey negative number of keys\n";
+        return;
+    }
+
+    Guard guard(&epochs_);
+    ConcurrentNode<T> *preds[H_MAX], *succs[H_MAX], *pred, *succ, *node;
+    int found, height, old_count, top;
+    bool valid;
+
+    while (true) {
+        found = findPath(key, preds, succs);
+
+        if (found != -1) {
+            node = succs[found];
+
+            if (!node->marked_.load(std::memory_order_acquire)) {
+                while (!node->fully_linked_.load(std::memory_order_acquire)) {
+                    std::this_thread::yield();
+                }
+
+                // A zero count means the node is being unlinked by an erase
+                old_count = node->count_.load(std::memory_order_acquire);
+                while (old_count > 0 && !node->count_.compare_exchange_weak(
+                    old_count, old_count + count)) {
+                }
+
+                if (old_count > 0) {
+                    num_elem_.fetch_add(count);
+                    return;
+                }
+            }
+
+            // Wait for the old node to be unlinked and try again
+            std::this_thread::yield();
+            continue;
+        }
+
+        height = getNewHeight();
+        valid = true;
+        top = -1;
+
+        // Locks are always taken from the lowest level up (right to left
+        // in the list), the same order as in eraseKey, so no deadlocks
+        for (int i = 0; valid && i < height; ++i) {
+            pred = preds[i];
+            succ = succs[i];
+
+            if (i == 0 || pred != preds[i - 1]) {
+                pred->lock_.lock();
+            }
+            top = i;
+
+            valid = !pred->marked_.load(std::memory_order_acquire) &&
+                (!succ || !succ->marked_.load(std::memory_order_acquire)) &&
+                pred->next_[i].load(std::memory_order_acquire) == succ;
+        }
+
+        if (!valid) {
+            unlockPath(preds, top);
+            continue;
+        }
+
+        node = new ConcurrentNode<T>(key, height, count);
+
+        for (int i = 0; i < height; ++i) {
+            node->next_[i].store(succs[i], std::memory_order_relaxed);
+        }
+
+        for (int i = 0; i < height; ++i) {
+            preds[i]->next_[i].store(node, std::memory_order_release);
+        }
+
+        node->fully_linked_.store(true, std::memory_order_release);
+        unlockPath(preds, top);
+
+        num_nodes_.fetch_add(1);
+        num_elem_.fetch_add(count);
+        return;
+    }
+}
+
+/*
+ * Erase count keys from the skip list (count = 1 default).
+ * O(logn)
+ */
+template <class T, class Comparator>
+void
+ConcurrentSkipList<T, Comparator> :: eraseKey(const T& key, int count) {
+    try {
+        if (count < 1) {
+            throw 1;
+        }
+    } catch (...) {
+        std::cerr << "Standard exception: eraseKey negative number of keys\n";
+        return;
+    }
+
+    Guard guard(&epochs_);
+    ConcurrentNode<T> *preds[H_MAX], *succs[H_MAX];
+    int found = findPath(key, preds, succs);
+
+    if (found != -1) {
+        takeCount(succs[found], count);
+    }
+}
+
+/*
+ * Free the unlinked nodes that no guard can reach any more, without
+ * waiting for the next batch. Safe to call at any time; with no other
+ * thread in the list it frees them all.
+ * O(EPOCH_STRIPES + nodes freed)
+ */
+template <class T, class Comparator>
+void
+ConcurrentSkipList<T, Comparator> :: reclaim() {
+    for (int i = 0; i < 3 && epochs_.advance(); ++i) {
+    }
+}
+
+/*
+ * Lock-free descent, stops at the first level where the key is found.
+ */
+template <class T, class Comparator>
+ConcurrentNode<T>*
+ConcurrentSkipList<T, Comparator> :: lookup(const T& key) {
+    ConcurrentNode<T> *curr, *pred = head_;
+
+    for (int i = H_MAX - 1; i > -1; --i) {
+        curr = pred->next_[i].load(std::memory_order_acquire);
+
+        while (curr && comp_(key, curr->data_)) {
+            pred = curr;
+            curr = pred->next_[i].load(std::memory_order_acquire);
+        }
+
+        if (curr && key == curr->data_) {
+            return curr;
+        }
+    }
+
+    return nullptr;
+}
+
+/*
+ * Fill for each level the last node before key (preds) and the node after
+ * it (succs). Return the highest level where the key was found or -1.
+ */
+template <class T, class Comparator>
+int
+ConcurrentSkipList<T, Comparator> :: findPath(const T& key,
+    ConcurrentNode<T>** preds, ConcurrentNode<T>** succs) {
+    ConcurrentNode<T> *curr, *pred = head_;
+    int found = -1;
+
+    for (int i = H_MAX - 1; i > -1; --i) {
+        curr = pred->next_[i].load(std::memory_order_acquire);
+
+        while (curr && comp_(key, curr->data_)) {
+            pred = curr;
+            curr = pred->next_[i].load(std::memory_order_acquire);
+        }
+
+        if (found == -1 && curr && key == curr->data_) {
+            found = i;
+        }
+
+        preds[i] = pred;
+        succs[i] = curr;
+    }
+
+    return found;
+}
+
+/*
+ * Take up to count keys from the counter of victim and return how many
+ * were taken (0 if the node is already being erased). The counter is
+ * decreased with CAS; the thread that takes it to zero marks the node
+ * (logical delete) and unlinks it level by level. Called with a guard.
+ * O(logn)
+ */
+template <class T, class Comparator>
+int
+ConcurrentSkipList<T, Comparator> :: takeCount(ConcurrentNode<T>* victim,
+    int count) {
+    ConcurrentNode<T> *preds[H_MAX], *succs[H_MAX], *pred;
+    int old_count, new_count, top;
+    bool valid;
+
+    if (victim->marked_.load(std::memory_order_acquire)) {
+        return 0;
+    }
+
+    while (!victim->fully_linked_.load(std::memory_order_acquire)) {
+        std::this_thread::yield();
+    }
+
+    old_count = victim->count_.load(std::memory_order_acquire);
+    do {
+        if (old_count == 0) {
+            return 0;
+        }
+
+        new_count = (old_count > count)? old_count - count: 0;
+    } while (!victim->count_.compare_exchange_weak(old_count, new_count));
+
+    num_elem_.fetch_sub(old_count - new_count);
+    if (new_count > 0) {
+        return old_count - new_count;
+    }
+
+    // Only this thread got the counter to zero, so only it unlinks the node
+    victim->lock_.lock();
+    victim->marked_.store(true, std::memory_order_release);
+
+    while (true) {
+        findPath(victim->data_, preds, succs);
+        valid = true;
+        top = -1;
+
+        for (int i = 0; valid && i < victim->height_; ++i) {
+            pred = preds[i];
+
+            if (i == 0 || pred != preds[i - 1]) {
+                pred->lock_.lock();
+            }
+            top = i;
+
+            valid = !pred->marked_.load(std::memory_order_acquire) &&
+                pred->next_[i].load(std::memory_order_acquire) == victim;
+        }
+
+        if (valid) {
+            break;
+        }
+
+        unlockPath(preds, top);
+    }
+
+    for (int i = victim->height_ - 1; i > -1; --i) {
+        preds[i]->next_[i].store(
+            victim->next_[i].load(std::memory_order_acquire),
+            std::memory_order_release);
+    }
+
+    victim->lock_.unlock();
+    unlockPath(preds, top);
+
+    num_nodes_.fetch_sub(1);
+    retire(victim);
+
+    return old_count;
+}
+
+/*
+ * Unlock the predecessors locked on levels 0..top (each node once).
+ */
+template <class T, class Comparator>
+void
+ConcurrentSkipList<T, Comparator> :: unlockPath(ConcurrentNode<T>** preds,
+    int top) {
+    for (int i = 0; i <= top; ++i) {
+        if (i == 0 || preds[i] != preds[i - 1]) {
+            preds[i]->lock_.unlock();
+        }
+    }
+}
+
+template <class T, class Comparator>
+void
+ConcurrentSkipList<T, Comparator> :: retire(ConcurrentNode<T>* node) {
+    epochs_.retire(node);
+}
+
+template <class T, class Comparator>
+ConcurrentNode<T>*
+ConcurrentSkipList<T, Comparator> :: skipMarked(ConcurrentNode<T>* node) {
+    while (node && node->marked_.load(std::memory_order_acquire)) {
+        node = node->next_[0].load(std::memory_order_acquire);
+    }
+
+    return node;
+}
+
+/*
+ * Every thread has its own generator, so taking a height is not
+ * a point of contention between writers.
+ */
+template <class T, class Comparator>
+int
+ConcurrentSkipList<T, Comparator> :: getNewHeight() {
+    static thread_local std::minstd_rand new_rand_(
+        static_cast<unsigned int>(time(nullptr)) ^ static_cast<unsigned int>(
+        std::hash<std::thread::id>()(std::this_thread::get_id())));
+    int height, random;
+
+    for (height = 1, random = new_rand_(); random & 1 && height < H_MAX;
+        random = (random >>= 1)? random: new_rand_(), ++height) {
+    }
+
+    return height;
+}
+
+#endif  // CONCURRENT_SKIP_LIST_H_
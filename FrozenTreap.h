@@ -0,0 +1,218 @@
+// Copyright 2019 Nedelcu Horia (nedelcu.horia.alexandru@gmail.com)
+
+/**
+*    Frozen Treap Implementation:
+*
+*    Immutable copy of a Treap (Treap::freeze) for tables that are built once
+* and then only searched. The keys are stored in one array in Eytzinger
+* order: the complete binary tree over the sorted keys, level by level, the
+* children of position i at 2i and 2i + 1 (the root at 1). A search is a
+* descent i = 2i + (key[i] < x) with no branch to mispredict, and the four
+* levels below the current position (positions 16i...16i + 15) are next
+* to each other, so they are prefetched while the current level is read.
+*    sizes[i] is the size of the subtree of i, for findK and rank, which go
+* down the same way.
+*/
+
+#ifndef FROZEN_TREAP_H_
+#define FROZEN_TREAP_H_
+
+#include <vector>
+#include <cstdint>
+#include <iostream>
+
+#if defined(__GNUC__)
+#define FROZEN_PREFETCH(address) __builtin_prefetch(address)
+#else
+#define FROZEN_PREFETCH(address)
+#endif
+
+template <class T>
+class FrozenTreap {
+    std::vector<T> keys_;
+    std::vector<uint32_t> sizes_;
+    uint32_t size_;
+
+ public:
+    FrozenTreap();
+    template <class InputIterator>
+    FrozenTreap(InputIterator, InputIterator);
+
+    int size() const;
+    bool isEmpty() const;
+
+    bool find(const T&) const;
+    const T* lower_bound(const T&) const;
+    int rank(const T&) const;
+    const T& findK(int k) const;
+
+ private:
+    uint32_t lowerIndex(const T&) const;
+    void fill(const std::vector<T>&, uint32_t, uint32_t&);
+    static uint32_t lastLeft(uint32_t);
+};
+
+/*
+ * Implementation:
+ */
+
+template <class T>
+FrozenTreap<T> :: FrozenTreap(): keys_(1), sizes_(2, 0), size_(0) {}
+
+/*
+ * The keys of [first, last) must be sorted (Treap::freeze gives them in
+ * order).
+ * O(n)
+ */
+template <class T>
+template <class InputIterator>
+FrozenTreap<T> :: FrozenTreap(InputIterator first, InputIterator last) {
+    std::vector<T> sorted(first, last);
+    uint32_t next = 0;
+
+    size_ = static_cast<uint32_t>(sorted.size());
+    keys_.resize(size_ + 1);
+    fill(sorted, 1, next);
+
+    // Children past the end count as empty subtrees
+    sizes_.assign(2 * size_ + 2, 0);
+    for (uint32_t i = size_; i > 0; --i) {
+        sizes_[i] = sizes_[2 * i] + sizes_[2 * i + 1] + 1;
+    }
+}
+
+template <class T>
+int
+FrozenTreap<T> :: size() const {
+    return size_;
+}
+
+template <class T>
+bool
+FrozenTreap<T> :: isEmpty() const {
+    return size_ == 0;
+}
+
+/*
+ * O(logn)
+ */
+template <class T>
+bool
+FrozenTreap<T> :: find(const T& key) const {
+    uint32_t i = lowerIndex(key);
+
+    return i && !(key < keys_[i]);
+}
+
+/*
+ * First key >= key, NULL if there is none.
+ * O(logn)
+ */
+template <class T>
+const T*
+FrozenTreap<T> :: lower_bound(const T& key) const {
+    uint32_t i = lowerIndex(key);
+
+    return i? &keys_[i]: NULL;
+}
+
+/*
+ * Number of keys < key. On the way down, every step to the right passes
+ * the node and its left subtree.
+ * O(logn)
+ */
+template <class T>
+int
+FrozenTreap<T> :: rank(const T& key) const {
+    uint32_t i = 1, right, rank = 0;
+
+    while (i <= size_) {
+        FROZEN_PREFETCH(&keys_[0] + 16 * i);
+        right = keys_[i] < key;
+        rank += right * (sizes_[2 * i] + 1);
+        i = 2 * i + right;
+    }
+
+    return rank;
+}
+
+/*
+ * The k-th key in order (1 <= k <= size). The descent goes left while the
+ * k-th key is the node or in its left subtree, so after the node it only
+ * goes right, and the node is the last turn to the left (like lowerIndex).
+ * O(logn)
+ */
+template <class T>
+const T&
+FrozenTreap<T> :: findK(int k) const {
+    uint32_t i = 1, left, right, rest = k;
+
+    try {
+        if (k < 1 || static_cast<int>(size_) < k) {
+            throw 1;
+        }
+    } catch (...) {
+        std::cerr << "Standard exception: index outside the bounds\n";
+        return keys_[0];
+    }
+
+    while (i <= size_) {
+        FROZEN_PREFETCH(&sizes_[0] + 16 * i);
+        left = sizes_[2 * i];
+        right = rest > left + 1;
+        rest -= right * (left + 1);
+        i = 2 * i + right;
+    }
+
+    return keys_[lastLeft(i)];
+}
+
+/*
+ * Position of the first key >= key, 0 if there is none.
+ */
+template <class T>
+uint32_t
+FrozenTreap<T> :: lowerIndex(const T& key) const {
+    uint32_t i = 1;
+
+    while (i <= size_) {
+        FROZEN_PREFETCH(&keys_[0] + 16 * i);
+        i = 2 * i + (keys_[i] < key);
+    }
+
+    return lastLeft(i);
+}
+
+/*
+ * In order walk of the implicit tree, taking the sorted keys one by one.
+ */
+template <class T>
+void
+FrozenTreap<T> :: fill(const std::vector<T>& sorted, uint32_t i,
+    uint32_t& next) {
+    if (i <= size_) {
+        fill(sorted, 2 * i, next);
+        keys_[i] = sorted[next++];
+        fill(sorted, 2 * i + 1, next);
+    }
+}
+
+/*
+ * The position past a leaf ends with the turns of the descent (1 = right):
+ * drop the right turns after the last left one, and that one too.
+ */
+template <class T>
+uint32_t
+FrozenTreap<T> :: lastLeft(uint32_t i) {
+#if defined(__GNUC__)
+    return i >> __builtin_ffs(~i);
+#else
+    while (i & 1) {
+        i >>= 1;
+    }
+
+    return i >> 1;
+#endif
+}
+
+#endif  // FROZEN_TREAP_H_
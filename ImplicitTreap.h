@@ -0,0 +1,452 @@
+// Copyright 2019 Nedelcu Horia (nedelcu.horia.alexandru@gmail.com)
+
+/**
+*    Implicit Treap Implementation:
+*
+*    A sequence (rope) kept in a treap ordered by position instead of key:
+* the position of a node is the number of nodes before it, found from the
+* subtree sizes (nr_nodes in Treap), so no key is stored. Every edit is a
+* split by count and a merge, O(logn) in expectation: insert and erase at
+* an index, cut a range out as another ImplicitTreap and paste one at an
+* index.
+*    reverse and add on a range are lazy: the root of the range (after two
+* splits) only gets a tag, which is pushed to the children when a later
+* operation goes through the node. T needs operator+ for add.
+*    Positions are 0-based and ranges are half-open, [first, last).
+*/
+
+#ifndef IMPLICIT_TREAP_H_
+#define IMPLICIT_TREAP_H_
+
+#include <ctime>
+#include <cstdint>
+#include <utility>
+#include <iostream>
+
+template <class T>
+struct ImplicitNode {
+    T value_;
+    T add_;
+    bool reversed_;
+    bool added_;
+    uint32_t priority_;
+    int size_;
+    ImplicitNode<T> *left_, *right_;
+
+    ImplicitNode(const T& value, uint32_t priority): value_(value), add_(),
+        reversed_(false), added_(false), priority_(priority), size_(1),
+        left_(NULL), right_(NULL) {}
+};
+
+template <class T>
+class ImplicitTreap {
+    ImplicitNode<T> *root_;
+    uint32_t rand_;
+
+ public:
+    ImplicitTreap();
+    ~ImplicitTreap();
+
+    ImplicitTreap(const ImplicitTreap<T>&) = delete;
+    ImplicitTreap<T>& operator=(const ImplicitTreap<T>&) = delete;
+    ImplicitTreap(ImplicitTreap<T>&&);
+    ImplicitTreap<T>& operator=(ImplicitTreap<T>&&);
+
+    int size();
+    bool isEmpty();
+    void clear();
+
+    void insert(int index, const T&);
+    void pushBack(const T&);
+    void erase(int index);
+    T& operator[](int index);
+
+    void reverse(int first, int last);
+    void add(int first, int last, const T&);
+    ImplicitTreap<T> cut(int first, int last);
+    void paste(int index, ImplicitTreap<T>&);
+
+    template <class Visitor>
+    void forEach(Visitor);
+
+ private:
+    static int size(ImplicitNode<T>*);
+    static void update(ImplicitNode<T>*);
+    static void push(ImplicitNode<T>*);
+    static void split(ImplicitNode<T>*, int, ImplicitNode<T>*&,
+        ImplicitNode<T>*&);
+    static ImplicitNode<T>* merge(ImplicitNode<T>*, ImplicitNode<T>*);
+    static void destroy(ImplicitNode<T>*);
+    template <class Visitor>
+    static void forEach(ImplicitNode<T>*, Visitor&);
+    bool checkRange(int, int);
+    uint32_t getPriority();
+};
+
+/*
+ * Implementation:
+ */
+
+template <class T>
+ImplicitTreap<T> :: ImplicitTreap(): root_(NULL),
+    rand_(static_cast<uint32_t>(time(nullptr)) | 1) {}
+
+template <class T>
+ImplicitTreap<T> :: ~ImplicitTreap() {
+    destroy(root_);
+}
+
+template <class T>
+ImplicitTreap<T> :: ImplicitTreap(ImplicitTreap<T>&& other):
+    root_(other.root_), rand_(other.rand_) {
+    other.root_ = NULL;
+}
+
+template <class T>
+ImplicitTreap<T>&
+ImplicitTreap<T> :: operator=(ImplicitTreap<T>&& other) {
+    if (this != &other) {
+        destroy(root_);
+        root_ = other.root_;
+        other.root_ = NULL;
+    }
+
+    return *this;
+}
+
+template <class T>
+int
+ImplicitTreap<T> :: size() {
+    return size(root_);
+}
+
+template <class T>
+bool
+ImplicitTreap<T> :: isEmpty() {
+    return root_ == NULL;
+}
+
+template <class T>
+void
+ImplicitTreap<T> :: clear() {
+    destroy(root_);
+    root_ = NULL;
+}
+
+/*
+ * Insert value so that it is at position index (0 <= index <= size).
+ * O(logn)
+ */
+template <class T>
+void
+ImplicitTreap<T> :: insert(int index, const T& value) {
+    ImplicitNode<T> *left, *right;
+
+    if (!checkRange(index, index)) {
+        return;
+    }
+
+    split(root_, index, left, right);
+    root_ = merge(merge(left, new ImplicitNode<T>(value, getPriority())),
+        right);
+}
+
+/*
+ * O(logn)
+ */
+template <class T>
+void
+ImplicitTreap<T> :: pushBack(const T& value) {
+    root_ = merge(root_, new ImplicitNode<T>(value, getPriority()));
+}
+
+/*
+ * O(logn)
+ */
+template <class T>
+void
+ImplicitTreap<T> :: erase(int index) {
+    ImplicitNode<T> *left, *middle, *right;
+
+    if (!checkRange(index, index + 1)) {
+        return;
+    }
+
+    split(root_, index, left, right);
+    split(right, 1, middle, right);
+    destroy(middle);
+    root_ = merge(left, right);
+}
+
+/*
+ * The tags on the path are pushed down, so the value is up to date.
+ * O(logn)
+ */
+template <class T>
+T&
+ImplicitTreap<T> :: operator[](int index) {
+    ImplicitNode<T> *it = root_;
+
+    try {
+        if (index < 0 || size() <= index) {
+            throw 1;
+        }
+    } catch (...) {
+        std::cerr << "Standard exception: index outside the bounds\n";
+        static T none;
+        return none = T();
+    }
+
+    while (true) {
+        push(it);
+
+        if (index < size(it->left_)) {
+            it = it->left_;
+        } else if (index == size(it->left_)) {
+            return it->value_;
+        } else {
+            index -= size(it->left_) + 1;
+            it = it->right_;
+        }
+    }
+}
+
+/*
+ * Reverse the order of the values in [first, last).
+ * O(logn)
+ */
+template <class T>
+void
+ImplicitTreap<T> :: reverse(int first, int last) {
+    ImplicitNode<T> *left, *middle, *right;
+
+    if (!checkRange(first, last) || first == last) {
+        return;
+    }
+
+    split(root_, first, left, right);
+    split(right, last - first, middle, right);
+    middle->reversed_ ^= true;
+    root_ = merge(merge(left, middle), right);
+}
+
+/*
+ * Add delta to every value in [first, last).
+ * O(logn)
+ */
+template <class T>
+void
+ImplicitTreap<T> :: add(int first, int last, const T& delta) {
+    ImplicitNode<T> *left, *middle, *right;
+
+    if (!checkRange(first, last) || first == last) {
+        return;
+    }
+
+    split(root_, first, left, right);
+    split(right, last - first, middle, right);
+    middle->value_ = middle->value_ + delta;
+    middle->add_ = middle->added_? middle->add_ + delta: delta;
+    middle->added_ = true;
+    root_ = merge(merge(left, middle), right);
+}
+
+/*
+ * Take [first, last) out of the sequence and return it.
+ * O(logn)
+ */
+template <class T>
+ImplicitTreap<T>
+ImplicitTreap<T> :: cut(int first, int last) {
+    ImplicitTreap<T> range;
+    ImplicitNode<T> *left, *right;
+
+    if (!checkRange(first, last)) {
+        return range;
+    }
+
+    split(root_, first, left, right);
+    split(right, last - first, range.root_, right);
+    root_ = merge(left, right);
+
+    return range;
+}
+
+/*
+ * Move the values of other (which is left empty) before position index.
+ * O(logn + logm)
+ */
+template <class T>
+void
+ImplicitTreap<T> :: paste(int index, ImplicitTreap<T>& other) {
+    ImplicitNode<T> *left, *right;
+
+    if (this == &other || !checkRange(index, index)) {
+        return;
+    }
+
+    split(root_, index, left, right);
+    root_ = merge(merge(left, other.root_), right);
+    other.root_ = NULL;
+}
+
+/*
+ * visit(value) for every value, in order.
+ * O(n)
+ */
+template <class T>
+template <class Visitor>
+void
+ImplicitTreap<T> :: forEach(Visitor visit) {
+    forEach(root_, visit);
+}
+
+template <class T>
+int
+ImplicitTreap<T> :: size(ImplicitNode<T>* node) {
+    return node? node->size_: 0;
+}
+
+template <class T>
+void
+ImplicitTreap<T> :: update(ImplicitNode<T>* node) {
+    node->size_ = size(node->left_) + size(node->right_) + 1;
+}
+
+/*
+ * Apply the tags of node to its children. The value of node already has
+ * its own add, so a tag only concerns the nodes below.
+ */
+template <class T>
+void
+ImplicitTreap<T> :: push(ImplicitNode<T>* node) {
+    ImplicitNode<T> *child;
+
+    if (node->reversed_) {
+        std::swap(node->left_, node->right_);
+
+        for (int i = 0; i < 2; ++i) {
+            child = i? node->right_: node->left_;
+            if (child) {
+                child->reversed_ ^= true;
+            }
+        }
+
+        node->reversed_ = false;
+    }
+
+    if (node->added_) {
+        for (int i = 0; i < 2; ++i) {
+            child = i? node->right_: node->left_;
+            if (child) {
+                child->value_ = child->value_ + node->add_;
+                child->add_ = child->added_? child->add_ + node->add_:
+                    node->add_;
+                child->added_ = true;
+            }
+        }
+
+        node->add_ = T();
+        node->added_ = false;
+    }
+}
+
+/*
+ * The first count values of node go to left, the others to right.
+ */
+template <class T>
+void
+ImplicitTreap<T> :: split(ImplicitNode<T>* node, int count,
+    ImplicitNode<T>*& left, ImplicitNode<T>*& right) {
+    if (!node) {
+        left = right = NULL;
+        return;
+    }
+
+    push(node);
+
+    if (size(node->left_) < count) {
+        split(node->right_, count - size(node->left_) - 1, node->right_,
+            right);
+        left = node;
+    } else {
+        split(node->left_, count, left, node->left_);
+        right = node;
+    }
+
+    update(node);
+}
+
+template <class T>
+ImplicitNode<T>*
+ImplicitTreap<T> :: merge(ImplicitNode<T>* left, ImplicitNode<T>* right) {
+    if (!left || !right) {
+        return left? left: right;
+    }
+
+    if (left->priority_ > right->priority_) {
+        push(left);
+        left->right_ = merge(left->right_, right);
+        update(left);
+
+        return left;
+    }
+
+    push(right);
+    right->left_ = merge(left, right->left_);
+    update(right);
+
+    return right;
+}
+
+template <class T>
+void
+ImplicitTreap<T> :: destroy(ImplicitNode<T>* node) {
+    if (node) {
+        destroy(node->left_);
+        destroy(node->right_);
+        delete node;
+    }
+}
+
+template <class T>
+template <class Visitor>
+void
+ImplicitTreap<T> :: forEach(ImplicitNode<T>* node, Visitor& visit) {
+    if (node) {
+        push(node);
+        forEach(node->left_, visit);
+        visit(node->value_);
+        forEach(node->right_, visit);
+    }
+}
+
+template <class T>
+bool
+ImplicitTreap<T> :: checkRange(int first, int last) {
+    try {
+        if (first < 0 || last < first || size() < last) {
+            throw 1;
+        }
+    } catch (...) {
+        std::cerr << "Standard exception: index outside the bounds\n";
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * xorshift32
+ */
+template <class T>
+uint32_t
+ImplicitTreap<T> :: getPriority() {
+    rand_ ^= rand_ << 13;
+    rand_ ^= rand_ >> 17;
+    rand_ ^= rand_ << 5;
+
+    return rand_;
+}
+
+#endif  // IMPLICIT_TREAP_H_
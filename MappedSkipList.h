@@ -0,0 +1,329 @@
+// Copyright 2019 Nedelcu Horia (nedelcu.horia.alexandru@gmail.com)
+
+/**
+*    Mapped SkipList Implementation:
+*
+*    Read-only skip list served straight from a snapshot written by
+* SkipList::save. The file is mapped in memory (mmap) and nothing is
+* deserialized: the keys, counts and heights are arrays in the file and the
+* towers are kept as lanes of offsets (see SkipListFileHeader), so opening
+* costs the same for any size and processes that map the same file share
+* the page cache. The lane entries are checked as the searches read them.
+*    Search to find by key: like in SkipList it starts at the highest lane
+* and moves right while the key is bigger, then goes down to the position of
+* the same node in the lane below. Access by index is direct, the keys are
+* stored in order.
+*    Needs POSIX (mmap).
+*/
+
+#ifndef MAPPED_SKIP_LIST_H_
+#define MAPPED_SKIP_LIST_H_
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+
+#include "SkipList.h"
+
+template <class T, class Comparator = DefaulComparator<T> >
+class MappedSkipList {
+    void *map_;
+    size_t map_size_;
+    int num_elem_;
+    int num_nodes_;
+    int levels_;
+    const T *keys_;
+    const int32_t *counts_;
+    const unsigned char *heights_;
+    const SkipListFileLane *lanes_[SNAPSHOT_LEVELS];
+    int lane_size_[SNAPSHOT_LEVELS];
+    Comparator comp_;
+
+ public:
+    MappedSkipList();
+    ~MappedSkipList();
+
+    MappedSkipList(const MappedSkipList<T, Comparator>&) = delete;
+    MappedSkipList<T, Comparator>&
+    operator=(const MappedSkipList<T, Comparator>&) = delete;
+
+    bool open(const char*);
+    void close();
+
+    int size();
+    int length();
+    bool isEmpty();
+
+    int findKey(const T&);
+    int countKey(const T&);
+    bool searchKey(const T&);
+    int height(int index);
+
+    const T& topKey();
+    const T& operator[](int index);
+
+ private:
+    int findLast(const T&);
+    bool fits(uint64_t offset, uint64_t count, size_t size);
+};
+
+/*
+ * Implementation:
+ */
+
+template <class T, class Comparator>
+MappedSkipList<T, Comparator> :: MappedSkipList(): map_(nullptr),
+    map_size_(0), num_elem_(0), num_nodes_(0), levels_(0), keys_(nullptr),
+    counts_(nullptr), heights_(nullptr), comp_() {
+    memset(lanes_, 0, sizeof(lanes_));
+    memset(lane_size_, 0, sizeof(lane_size_));
+}
+
+template <class T, class Comparator>
+MappedSkipList<T, Comparator> :: ~MappedSkipList() {
+    close();
+}
+
+/*
+ * Map the snapshot from path. The header is checked against T and against
+ * the size of the file before anything is read from the mapping; the lane
+ * entries are not read here (see findLast).
+ * O(1)
+ */
+template <class T, class Comparator>
+bool
+MappedSkipList<T, Comparator> :: open(const char* path) {
+    struct stat info;
+    const SkipListFileHeader *header;
+    const char *base;
+    bool valid;
+    int fd;
+
+    close();
+
+    fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Standard exception: can't open " << path << '\n';
+        return false;
+    }
+
+    if (fstat(fd, &info) < 0 ||
+        static_cast<size_t>(info.st_size) < sizeof(SkipListFileHeader)) {
+        std::cerr << "Standard exception: bad snapshot " << path << '\n';
+        ::close(fd);
+        return false;
+    }
+
+    map_size_ = info.st_size;
+    map_ = mmap(nullptr, map_size_, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+
+    if (map_ == MAP_FAILED) {
+        std::cerr << "Standard exception: can't map " << path << '\n';
+        map_ = nullptr;
+        return false;
+    }
+
+    base = static_cast<const char*>(map_);
+    header = static_cast<const SkipListFileHeader*>(map_);
+
+    valid = !memcmp(header->magic_, SNAPSHOT_MAGIC, 4) &&
+        header->version_ == SNAPSHOT_VERSION &&
+        header->key_size_ == sizeof(T) &&
+        header->levels_ >= 1 && header->levels_ <= SNAPSHOT_LEVELS &&
+        header->num_nodes_ <= INT32_MAX && header->num_elem_ <= INT32_MAX &&
+        fits(header->keys_offset_, header->num_nodes_, sizeof(T)) &&
+        fits(header->counts_offset_, header->num_nodes_, sizeof(int32_t)) &&
+        fits(header->heights_offset_, header->num_nodes_, 1);
+
+    for (uint32_t i = 1; valid && i < header->levels_; ++i) {
+        valid = header->lane_size_[i] <= INT32_MAX &&
+            fits(header->lane_offset_[i], header->lane_size_[i],
+                sizeof(SkipListFileLane));
+    }
+
+    if (valid) {
+        num_elem_ = static_cast<int>(header->num_elem_);
+        num_nodes_ = static_cast<int>(header->num_nodes_);
+        levels_ = static_cast<int>(header->levels_);
+        keys_ = reinterpret_cast<const T*>(base + header->keys_offset_);
+        counts_ = reinterpret_cast<const int32_t*>(
+            base + header->counts_offset_);
+        heights_ = reinterpret_cast<const unsigned char*>(
+            base + header->heights_offset_);
+
+        for (int i = 1; i < levels_; ++i) {
+            lanes_[i] = reinterpret_cast<const SkipListFileLane*>(
+                base + header->lane_offset_[i]);
+            lane_size_[i] = static_cast<int>(header->lane_size_[i]);
+        }
+    }
+
+    if (!valid) {
+        std::cerr << "Standard exception: bad snapshot " << path << '\n';
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+template <class T, class Comparator>
+void
+MappedSkipList<T, Comparator> :: close() {
+    if (map_) {
+        munmap(map_, map_size_);
+    }
+
+    map_ = nullptr;
+    map_size_ = 0;
+    num_elem_ = num_nodes_ = levels_ = 0;
+    memset(lane_size_, 0, sizeof(lane_size_));
+}
+
+template <class T, class Comparator>
+int
+MappedSkipList<T, Comparator> :: size() {
+    return num_elem_;
+}
+
+template <class T, class Comparator>
+int
+MappedSkipList<T, Comparator> :: length() {
+    return num_nodes_;
+}
+
+template <class T, class Comparator>
+bool
+MappedSkipList<T, Comparator> :: isEmpty() {
+    return num_nodes_ == 0;
+}
+
+/*
+ * Search for key and return its index or -1 if it isn't there.
+ * O(logn)
+ */
+template <class T, class Comparator>
+int
+MappedSkipList<T, Comparator> :: findKey(const T& key) {
+    int index = findLast(key) + 1;
+
+    if (index == num_nodes_ || key != keys_[index]) {
+        return -1;
+    } else {
+        return index;
+    }
+}
+
+/*
+ * Search for key and returns how many times the key is in the snapshot.
+ * O(logn)
+ */
+template <class T, class Comparator>
+int
+MappedSkipList<T, Comparator> :: countKey(const T& key) {
+    int index = findKey(key);
+
+    return (index < 0)? 0: counts_[index];
+}
+
+template <class T, class Comparator>
+bool
+MappedSkipList<T, Comparator> :: searchKey(const T& key) {
+    return findKey(key) >= 0;
+}
+
+/*
+ * Height of the tower the node at index had in the saved skip list.
+ */
+template <class T, class Comparator>
+int
+MappedSkipList<T, Comparator> :: height(int index) {
+    return heights_[index];
+}
+
+template <class T, class Comparator>
+const T&
+MappedSkipList<T, Comparator> :: topKey() {
+    try {
+        if (num_nodes_ < 1) {
+            throw 1;
+        }
+    } catch (...) {
+        std::cerr << "Standard exception: empty list\n";
+    }
+
+    return keys_[0];
+}
+
+/*
+ * Return date from position index.
+ * O(1)
+ */
+template <class T, class Comparator>
+const T&
+MappedSkipList<T, Comparator> :: operator[](int index) {
+    try {
+        if (index < 0 || num_nodes_ <= index) {
+            throw 1;
+        }
+    } catch (...) {
+        std::cerr << "Standard exception: index outside the bounds\n";
+    }
+
+    return keys_[index];
+}
+
+/*
+ * Index of the last key before key (-1 for none). pos is the position in
+ * the current lane (-1 = head) and goes down through down offsets. The
+ * entries of a corrupt file are clamped as they are read: a node outside
+ * the keys ends the lane and a down offset outside the lane below starts
+ * that lane again from the head, so the search stays inside the mapping
+ * (the lowest level, the keys, still gives the answer).
+ */
+template <class T, class Comparator>
+int
+MappedSkipList<T, Comparator> :: findLast(const T& key) {
+    uint32_t below;
+    int pos = -1;
+
+    for (int i = levels_ - 1; i > 0; --i) {
+        const SkipListFileLane *lane = lanes_[i];
+        below = static_cast<uint32_t>((i == 1)? num_nodes_:
+            lane_size_[i - 1]);
+
+        while (pos + 1 < lane_size_[i] &&
+            lane[pos + 1].node_ < static_cast<uint32_t>(num_nodes_) &&
+            comp_(key, keys_[lane[pos + 1].node_])) {
+            ++pos;
+        }
+
+        pos = (pos < 0 || lane[pos].down_ >= below)? -1:
+            static_cast<int>(lane[pos].down_);
+    }
+
+    while (pos + 1 < num_nodes_ && comp_(key, keys_[pos + 1])) {
+        ++pos;
+    }
+
+    return pos;
+}
+
+/*
+ * Whether count items of size bytes from offset are inside the mapping,
+ * without computing offset + count * size (it could wrap around).
+ */
+template <class T, class Comparator>
+bool
+MappedSkipList<T, Comparator> :: fits(uint64_t offset, uint64_t count,
+    size_t size) {
+    return offset <= map_size_ && count <= (map_size_ - offset) / size;
+}
+
+#endif  // MAPPED_SKIP_LIST_H_
@@ -0,0 +1,1237 @@
+// Copyright 2019 Nedelcu Horia (nedelcu.horia.alexandru@gmail.com)
+
+/**
+*    MemTable Implementation:
+*
+*    Write buffer of a small log-structured key store built on SkipList.
+* The keys (with counts, like in SkipList) go to the live skip list. When
+* it holds limit distinct keys (capacity() of the list by default) it is
+* frozen - moved aside in O(1) - and a fresh list takes the new writes while
+* a background thread streams the frozen one to disk as an immutable sorted
+* run. A read adds up the count of the key in the live list, in the frozen
+* list and in every run, so the data can grow larger than the memory.
+* Counts only grow: nothing is taken back out of a run.
+*    Runs are compacted size-tiered: a run is named after the flushes it
+* holds (run-first-last.skr) and whenever the RUN_MERGE_FACTOR newest runs
+* hold the same number of flushes the flush thread merges them into one,
+* like a counter in base RUN_MERGE_FACTOR. So there are at most
+* (RUN_MERGE_FACTOR - 1) runs for each power of RUN_MERGE_FACTOR flushes
+* and a key is rewritten O(log(number of flushes)) times.
+*    Sorted run file: header, data blocks of RUN_BLOCK_KEYS keys, sparse
+* index (offset and size of every block and its first key), bloom filter
+* (BLOOM_BITS_PER_KEY bits for each key, BLOOM_HASHES probes). In a block
+* the keys of integer type are delta + zigzag varint encoded (other keys
+* are copied byte by byte) and the counts are varints. The index and the
+* filter are kept in memory, so a point read on a run costs one filter
+* check and, if it passes, the binary search of the index and the decoding
+* of one block.
+*    Needs POSIX (pread, mkdir, opendir).
+*/
+
+#ifndef MEM_TABLE_H_
+#define MEM_TABLE_H_
+
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <queue>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <memory>
+#include <cstdio>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <iostream>
+#include <algorithm>
+#include <type_traits>
+#include <condition_variable>
+
+#include "SkipList.h"
+
+#define RUN_MAGIC "SKLR"
+#define RUN_VERSION 1
+#define RUN_BLOCK_KEYS 128
+#define BLOOM_BITS_PER_KEY 10
+#define BLOOM_HASHES 7
+#define RUN_MERGE_FACTOR 4
+
+template <class T, class Comparator> class SortedRun;
+template <class T, class Comparator = DefaulComparator<T>,
+    class Policy = SkipListPolicy<> > class MemTable;
+
+/*
+ * Header of a sorted run file. After it come the data blocks, then the
+ * index (num_blocks SortedRunBlock), the first key of every block and the
+ * bloom filter (bloom_bits bits). Offsets are from the start of the file.
+ */
+struct SortedRunHeader {
+    char magic_[4];
+    uint32_t version_;
+    uint32_t key_size_;
+    uint32_t encoding_;
+    uint64_t num_keys_;
+    uint64_t num_elem_;
+    uint64_t num_blocks_;
+    uint64_t index_offset_;
+    uint64_t keys_offset_;
+    uint64_t bloom_offset_;
+    uint64_t bloom_bits_;
+};
+
+struct SortedRunBlock {
+    uint64_t offset_;
+    uint32_t bytes_;
+    uint32_t num_keys_;
+};
+
+inline void putVarint(std::vector<unsigned char>& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<unsigned char>(value | 0x80));
+        value >>= 7;
+    }
+
+    out.push_back(static_cast<unsigned char>(value));
+}
+
+/*
+ * Return the position after the varint or NULL if it runs past end.
+ */
+inline const unsigned char* getVarint(const unsigned char* in,
+    const unsigned char* end, uint64_t& value) {
+    value = 0;
+
+    for (int shift = 0; in < end && shift < 64; shift += 7) {
+        value |= static_cast<uint64_t>(*in & 0x7f) << shift;
+
+        if (!(*in++ & 0x80)) {
+            return in;
+        }
+    }
+
+    return nullptr;
+}
+
+/*
+ * fsync the directory of path, so that a file just renamed into it is
+ * still there after a crash.
+ */
+inline bool syncParentDir(const char* path) {
+    std::string dir(path);
+    size_t slash = dir.rfind('/');
+    bool synced;
+    int fd;
+
+    dir = (slash == std::string::npos)? ".": dir.substr(0, slash + 1);
+
+    fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd < 0) {
+        return false;
+    }
+
+    synced = fsync(fd) == 0;
+    ::close(fd);
+
+    return synced;
+}
+
+/*
+ * FNV-1a over the bytes of the key, mixed so that the high half is usable
+ * as a second hash.
+ */
+inline uint64_t runHash(const void* data, size_t size) {
+    const unsigned char *bytes = static_cast<const unsigned char*>(data);
+    uint64_t hash = 14695981039346656037ull;
+
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+
+    return hash;
+}
+
+/*
+ * Encoding of the keys of a block: each key is written relative to the
+ * previous one (T() for the first). Generic keys are copied as they are.
+ */
+template <class T, class Enable = void>
+struct RunCodec {
+    static const uint32_t kEncoding = 0;
+
+    static void put(std::vector<unsigned char>& out, const T& key, const T&) {
+        const unsigned char *bytes = reinterpret_cast<const unsigned char*>(
+            &key);
+
+        out.insert(out.end(), bytes, bytes + sizeof(T));
+    }
+
+    static const unsigned char* get(const unsigned char* in,
+        const unsigned char* end, T& key, const T&) {
+        if (end - in < static_cast<long>(sizeof(T))) {
+            return nullptr;
+        }
+
+        memcpy(&key, in, sizeof(T));
+        return in + sizeof(T);
+    }
+};
+
+/*
+ * Integer keys: the difference to the previous key (modulo 2^64), zigzag
+ * encoded so that small differences of any sign take few bytes.
+ */
+template <class T>
+struct RunCodec<T, typename std::enable_if<std::is_integral<T>::value>::type> {
+    static const uint32_t kEncoding = 1;
+
+    static void put(std::vector<unsigned char>& out, const T& key,
+        const T& prev) {
+        uint64_t delta = static_cast<uint64_t>(key)
+            - static_cast<uint64_t>(prev);
+
+        putVarint(out, (delta << 1) ^ (0 - (delta >> 63)));
+    }
+
+    static const unsigned char* get(const unsigned char* in,
+        const unsigned char* end, T& key, const T& prev) {
+        uint64_t zigzag;
+
+        in = getVarint(in, end, zigzag);
+        key = static_cast<T>(static_cast<uint64_t>(prev)
+            + ((zigzag >> 1) ^ (0 - (zigzag & 1))));
+
+        return in;
+    }
+};
+
+/*
+ * Immutable sorted run on disk (see the file format above). The file stays
+ * open and blocks are read with pread, so several threads can read a run
+ * at the same time.
+ */
+template <class T, class Comparator>
+class SortedRun {
+    static_assert(std::is_trivially_copyable<T>::value,
+        "sorted runs need keys that can be copied byte by byte");
+
+    int fd_;
+    SortedRunHeader header_;
+    std::vector<SortedRunBlock> blocks_;
+    std::vector<T> first_keys_;
+    std::vector<unsigned char> bloom_;
+    Comparator comp_;
+
+ public:
+    typedef std::vector<std::pair<T, int> > Entries;
+
+    SortedRun();
+    ~SortedRun();
+
+    SortedRun(const SortedRun<T, Comparator>&) = delete;
+    SortedRun<T, Comparator>&
+    operator=(const SortedRun<T, Comparator>&) = delete;
+
+    template <class Policy>
+    static bool write(const char*, SkipList<T, Comparator, Policy>&);
+    static bool merge(const char*,
+        const std::vector<std::shared_ptr<SortedRun<T, Comparator> > >&);
+    bool open(const char*);
+    void close();
+
+    int size();
+    int length();
+
+    bool mayContain(const T&);
+    int countKey(const T&);
+
+    /*
+     * Sequential reader, one block in memory at a time.
+     */
+    class cursor {
+        friend class SortedRun<T, Comparator>;
+        SortedRun<T, Comparator> *run;
+        int block;
+        size_t pos;
+        Entries entries;
+
+     public:
+        cursor();
+
+        bool valid();
+        const T& key();
+        int count();
+        void next();
+    };
+
+    cursor begin();
+    cursor seek(const T&);
+
+ private:
+    template <class Source>
+    static bool writeEntries(const char*, uint64_t, Source);
+    int findBlock(const T&);
+    bool readBlock(int, Entries&);
+    static bool fits(uint64_t, uint64_t offset, uint64_t count, size_t size);
+    static uint64_t bloomBit(uint64_t hash, int probe, uint64_t bits);
+};
+
+template <class T, class Comparator, class Policy>
+class MemTable {
+    typedef SkipList<T, Comparator, Policy> List;
+    typedef SortedRun<T, Comparator> Run;
+
+    std::string dir_;
+    int limit_;
+    int next_run_;
+    bool flushing_;
+    bool stop_;
+    List live_, frozen_;
+    std::vector<std::shared_ptr<Run> > runs_;
+    std::vector<std::pair<int, int> > ranges_;  // first, last flush
+    std::mutex lock_;
+    std::condition_variable flush_cv_, done_cv_;
+    std::thread flusher_;
+    Comparator comp_;
+
+ public:
+    explicit MemTable(const std::string& dir, int limit = Policy::kCapacity);
+    ~MemTable();
+
+    MemTable(const MemTable<T, Comparator, Policy>&) = delete;
+    MemTable<T, Comparator, Policy>&
+    operator=(const MemTable<T, Comparator, Policy>&) = delete;
+
+    void insertKey(const T&, int count_ = 1);
+    int countKey(const T&);
+    bool searchKey(const T&);
+    template <class Visitor>
+    void scan(const T&, const T&, Visitor);
+
+    void flush();
+    int runs();
+
+ private:
+    void freeze(std::unique_lock<std::mutex>&);
+    void flushLoop();
+    void compact(std::unique_lock<std::mutex>&);
+    bool sameTier(int);
+    std::string runPath(int, int);
+};
+
+/*
+ * Implementation:
+ */
+
+template <class T, class Comparator>
+SortedRun<T, Comparator> :: SortedRun(): fd_(-1), comp_() {
+    memset(&header_, 0, sizeof(header_));
+}
+
+template <class T, class Comparator>
+SortedRun<T, Comparator> :: ~SortedRun() {
+    close();
+}
+
+/*
+ * Stream list to path as a sorted run.
+ * O(n)
+ */
+template <class T, class Comparator>
+template <class Policy>
+bool
+SortedRun<T, Comparator> :: write(const char* path,
+    SkipList<T, Comparator, Policy>& list) {
+    auto it = list.begin();
+
+    return writeEntries(path, list.length(), [&](T& key, int& count) {
+        if (it == list.end()) {
+            return false;
+        }
+
+        key = *it;
+        count = it.count();
+        ++it;
+
+        return true;
+    });
+}
+
+/*
+ * Write the keys of runs as one sorted run at path, the counts of a key
+ * added up. The runs are read block by block and merged with a heap.
+ * O(n * log(number of runs))
+ */
+template <class T, class Comparator>
+bool
+SortedRun<T, Comparator> :: merge(const char* path,
+    const std::vector<std::shared_ptr<SortedRun<T, Comparator> > >& runs) {
+    typedef std::pair<T, int> Head;  // key, run
+
+    std::vector<cursor> cursors;
+    uint64_t max_keys = 0;
+    Comparator comp;
+
+    auto after = [&comp](const Head& lhs, const Head& rhs) {
+        return comp(lhs.first, rhs.first);
+    };
+    std::priority_queue<Head, std::vector<Head>, decltype(after)> heap(after);
+
+    for (size_t i = 0; i < runs.size(); ++i) {
+        cursors.push_back(runs[i]->begin());
+        max_keys += runs[i]->length();
+
+        if (cursors[i].valid()) {
+            heap.push(Head(cursors[i].key(), i));
+        }
+    }
+
+    return writeEntries(path, max_keys, [&](T& key, int& count) {
+        int source;
+
+        if (heap.empty()) {
+            return false;
+        }
+
+        key = heap.top().first;
+        count = 0;
+
+        while (!heap.empty() && !(heap.top().first != key)) {
+            source = heap.top().second;
+            heap.pop();
+
+            count += cursors[source].count();
+            cursors[source].next();
+            if (cursors[source].valid()) {
+                heap.push(Head(cursors[source].key(), source));
+            }
+        }
+
+        return true;
+    });
+}
+
+/*
+ * Write the keys given by next(key, count) (false after the last one, in
+ * order) to path as a sorted run; max_keys sizes the bloom filter. The
+ * data blocks are written as they are filled, the index and the filter at
+ * the end; the file is written under a temporary name, synced, renamed
+ * when complete and the directory is synced after the rename.
+ * O(n)
+ */
+template <class T, class Comparator>
+template <class Source>
+bool
+SortedRun<T, Comparator> :: writeEntries(const char* path,
+    uint64_t max_keys, Source next) {
+    std::string tmp_path = std::string(path) + ".tmp";
+    std::vector<unsigned char> buffer;
+    std::vector<SortedRunBlock> blocks;
+    std::vector<T> first_keys;
+    std::vector<unsigned char> bloom;
+    SortedRunHeader header;
+    SortedRunBlock block;
+    uint64_t offset = sizeof(header), hash;
+    T key, prev = T();
+    int times;
+    bool written;
+    FILE *file;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic_, RUN_MAGIC, 4);
+    header.version_ = RUN_VERSION;
+    header.key_size_ = sizeof(T);
+    header.encoding_ = RunCodec<T>::kEncoding;
+    header.bloom_bits_ = std::max<uint64_t>(64,
+        (max_keys * BLOOM_BITS_PER_KEY + 7) / 8 * 8);
+    bloom.assign(header.bloom_bits_ / 8, 0);
+
+    file = fopen(tmp_path.c_str(), "wb");
+    if (!file) {
+        std::cerr << "Standard exception: can't open " << tmp_path << '\n';
+        return false;
+    }
+
+    auto write = [&](const void* data, size_t size, size_t count) {
+        return count == 0 || fwrite(data, size, count, file) == count;
+    };
+
+    // The header is written again at the end, with the offsets
+    written = write(&header, sizeof(header), 1);
+    block.num_keys_ = 0;
+
+    auto closeBlock = [&]() {
+        block.offset_ = offset;
+        block.bytes_ = static_cast<uint32_t>(buffer.size());
+        blocks.push_back(block);
+        offset += buffer.size();
+
+        written = written && write(buffer.data(), 1, buffer.size());
+        buffer.clear();
+        block.num_keys_ = 0;
+    };
+
+    while (written && next(key, times)) {
+        if (block.num_keys_ == 0) {
+            first_keys.push_back(key);
+            prev = T();
+        }
+
+        RunCodec<T>::put(buffer, key, prev);
+        putVarint(buffer, static_cast<uint64_t>(times));
+        prev = key;
+        ++header.num_keys_;
+        header.num_elem_ += times;
+
+        hash = runHash(&key, sizeof(T));
+        for (int i = 0; i < BLOOM_HASHES; ++i) {
+            uint64_t bit = bloomBit(hash, i, header.bloom_bits_);
+            bloom[bit / 8] |= static_cast<unsigned char>(1 << (bit % 8));
+        }
+
+        if (++block.num_keys_ == RUN_BLOCK_KEYS) {
+            closeBlock();
+        }
+    }
+
+    if (block.num_keys_) {
+        closeBlock();
+    }
+
+    header.num_blocks_ = blocks.size();
+    header.index_offset_ = offset;
+    header.keys_offset_ = offset + blocks.size() * sizeof(SortedRunBlock);
+    header.bloom_offset_ = header.keys_offset_ + first_keys.size()
+        * sizeof(T);
+
+    written = written && write(blocks.data(), sizeof(SortedRunBlock),
+        blocks.size()) && write(first_keys.data(), sizeof(T),
+        first_keys.size()) && write(bloom.data(), 1, bloom.size())
+        && fseek(file, 0, SEEK_SET) == 0
+        && write(&header, sizeof(header), 1)
+        && fflush(file) == 0 && fsync(fileno(file)) == 0;
+    written = (fclose(file) == 0) && written
+        && rename(tmp_path.c_str(), path) == 0 && syncParentDir(path);
+
+    if (!written) {
+        std::cerr << "Standard exception: can't write " << path << '\n';
+        unlink(tmp_path.c_str());
+    }
+
+    return written;
+}
+
+/*
+ * Open the run at path; the header is checked against T and against the
+ * size of the file (without computing offset + count * size, it could
+ * wrap around), then the index and the filter are read in memory and
+ * every block is checked to lie in the file and to hold at most
+ * RUN_BLOCK_KEYS keys, so a corrupt run is refused instead of read.
+ * O(n / RUN_BLOCK_KEYS + bloom size)
+ */
+template <class T, class Comparator>
+bool
+SortedRun<T, Comparator> :: open(const char* path) {
+    struct stat info;
+    uint64_t file_size;
+    bool valid;
+
+    close();
+
+    fd_ = ::open(path, O_RDONLY);
+    if (fd_ < 0) {
+        std::cerr << "Standard exception: can't open " << path << '\n';
+        return false;
+    }
+
+    auto read = [&](void* data, size_t size, uint64_t offset) {
+        return size == 0 || pread(fd_, data, size, offset)
+            == static_cast<ssize_t>(size);
+    };
+
+    valid = fstat(fd_, &info) == 0 && read(&header_, sizeof(header_), 0);
+    file_size = valid? info.st_size: 0;
+
+    valid = valid && !memcmp(header_.magic_, RUN_MAGIC, 4) &&
+        header_.version_ == RUN_VERSION &&
+        header_.key_size_ == sizeof(T) &&
+        header_.encoding_ == RunCodec<T>::kEncoding &&
+        fits(file_size, header_.index_offset_, header_.num_blocks_,
+            sizeof(SortedRunBlock)) &&
+        fits(file_size, header_.keys_offset_, header_.num_blocks_,
+            sizeof(T)) &&
+        fits(file_size, header_.bloom_offset_, header_.bloom_bits_ / 8, 1) &&
+        header_.bloom_bits_ % 8 == 0 && header_.bloom_bits_ > 0 &&
+        header_.num_keys_ <= header_.num_blocks_ * RUN_BLOCK_KEYS;
+
+    if (valid) {
+        blocks_.resize(header_.num_blocks_);
+        first_keys_.resize(header_.num_blocks_);
+        bloom_.resize(header_.bloom_bits_ / 8);
+
+        valid = read(blocks_.data(), blocks_.size() * sizeof(SortedRunBlock),
+            header_.index_offset_) &&
+            read(first_keys_.data(), first_keys_.size() * sizeof(T),
+            header_.keys_offset_) &&
+            read(bloom_.data(), bloom_.size(), header_.bloom_offset_);
+    }
+
+    for (size_t i = 0; valid && i < blocks_.size(); ++i) {
+        valid = fits(file_size, blocks_[i].offset_, blocks_[i].bytes_, 1) &&
+            blocks_[i].num_keys_ >= 1 &&
+            blocks_[i].num_keys_ <= RUN_BLOCK_KEYS;
+    }
+
+    if (!valid) {
+        std::cerr << "Standard exception: bad sorted run " << path << '\n';
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+template <class T, class Comparator>
+void
+SortedRun<T, Comparator> :: close() {
+    if (fd_ >= 0) {
+        ::close(fd_);
+    }
+
+    fd_ = -1;
+    memset(&header_, 0, sizeof(header_));
+    blocks_.clear();
+    first_keys_.clear();
+    bloom_.clear();
+}
+
+template <class T, class Comparator>
+int
+SortedRun<T, Comparator> :: size() {
+    return static_cast<int>(header_.num_elem_);
+}
+
+template <class T, class Comparator>
+int
+SortedRun<T, Comparator> :: length() {
+    return static_cast<int>(header_.num_keys_);
+}
+
+/*
+ * False if the key is surely not in the run.
+ * O(BLOOM_HASHES)
+ */
+template <class T, class Comparator>
+bool
+SortedRun<T, Comparator> :: mayContain(const T& key) {
+    uint64_t hash = runHash(&key, sizeof(T)), bit;
+
+    if (bloom_.empty()) {
+        return false;
+    }
+
+    for (int i = 0; i < BLOOM_HASHES; ++i) {
+        bit = bloomBit(hash, i, header_.bloom_bits_);
+        if (!(bloom_[bit / 8] & (1 << (bit % 8)))) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * How many times the key is in the run.
+ * O(log(n / RUN_BLOCK_KEYS) + RUN_BLOCK_KEYS) when the filter passes
+ */
+template <class T, class Comparator>
+int
+SortedRun<T, Comparator> :: countKey(const T& key) {
+    Entries entries;
+    int block;
+
+    if (!mayContain(key) || (block = findBlock(key)) < 0 ||
+        !readBlock(block, entries)) {
+        return 0;
+    }
+
+    auto it = std::lower_bound(entries.begin(), entries.end(), key,
+        [this](const std::pair<T, int>& entry, const T& other) {
+            return comp_(other, entry.first);
+        });
+
+    return (it == entries.end() || key != it->first)? 0: it->second;
+}
+
+/*
+ * Cursor on the first key of the run.
+ * O(RUN_BLOCK_KEYS)
+ */
+template <class T, class Comparator>
+typename SortedRun<T, Comparator> :: cursor
+SortedRun<T, Comparator> :: begin() {
+    cursor it;
+
+    it.run = this;
+    it.block = 0;
+    it.pos = 0;
+
+    if (blocks_.empty() || !readBlock(0, it.entries)) {
+        it.block = static_cast<int>(blocks_.size());
+    }
+
+    return it;
+}
+
+/*
+ * Cursor on the first key of the run that is not before key.
+ * O(log(n / RUN_BLOCK_KEYS) + RUN_BLOCK_KEYS)
+ */
+template <class T, class Comparator>
+typename SortedRun<T, Comparator> :: cursor
+SortedRun<T, Comparator> :: seek(const T& key) {
+    cursor it;
+
+    it.run = this;
+    it.block = std::max(findBlock(key), 0);
+    it.pos = 0;
+
+    if (it.block < static_cast<int>(blocks_.size()) &&
+        readBlock(it.block, it.entries)) {
+        while (it.valid() && comp_(key, it.key())) {
+            it.next();
+        }
+    } else {
+        it.block = static_cast<int>(blocks_.size());
+    }
+
+    return it;
+}
+
+template <class T, class Comparator>
+SortedRun<T, Comparator> :: cursor :: cursor(): run(nullptr), block(0),
+    pos(0) {}
+
+template <class T, class Comparator>
+bool
+SortedRun<T, Comparator> :: cursor :: valid() {
+    return run && pos < entries.size();
+}
+
+template <class T, class Comparator>
+const T&
+SortedRun<T, Comparator> :: cursor :: key() {
+    return entries[pos].first;
+}
+
+template <class T, class Comparator>
+int
+SortedRun<T, Comparator> :: cursor :: count() {
+    return entries[pos].second;
+}
+
+template <class T, class Comparator>
+void
+SortedRun<T, Comparator> :: cursor :: next() {
+    if (++pos < entries.size()) {
+        return;
+    }
+
+    pos = 0;
+    entries.clear();
+
+    if (++block < static_cast<int>(run->blocks_.size())) {
+        run->readBlock(block, entries);
+    }
+}
+
+/*
+ * Last block whose first key is not after key (-1 if key comes before
+ * the whole run).
+ * O(log(n / RUN_BLOCK_KEYS))
+ */
+template <class T, class Comparator>
+int
+SortedRun<T, Comparator> :: findBlock(const T& key) {
+    int lo = 0, hi = static_cast<int>(first_keys_.size()), mid;
+
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+
+        if (comp_(first_keys_[mid], key)) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+
+    return lo - 1;
+}
+
+template <class T, class Comparator>
+bool
+SortedRun<T, Comparator> :: readBlock(int index, Entries& entries) {
+    const SortedRunBlock& block = blocks_[index];
+    std::vector<unsigned char> buffer(block.bytes_);
+    const unsigned char *in, *end;
+    uint64_t count;
+    T key, prev = T();
+
+    entries.clear();
+
+    if (block.bytes_ && pread(fd_, buffer.data(), block.bytes_,
+        block.offset_) != static_cast<ssize_t>(block.bytes_)) {
+        std::cerr << "Standard exception: can't read sorted run block\n";
+        return false;
+    }
+
+    in = buffer.data();
+    end = in + buffer.size();
+    entries.reserve(block.num_keys_);
+
+    for (uint32_t i = 0; in && i < block.num_keys_; ++i) {
+        in = RunCodec<T>::get(in, end, key, prev);
+        in = in? getVarint(in, end, count): nullptr;
+
+        if (in) {
+            entries.push_back(std::make_pair(key, static_cast<int>(count)));
+            prev = key;
+        }
+    }
+
+    if (!in) {
+        std::cerr << "Standard exception: bad sorted run block\n";
+        entries.clear();
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Whether count items of size bytes from offset are inside a file of
+ * file_size bytes.
+ */
+template <class T, class Comparator>
+bool
+SortedRun<T, Comparator> :: fits(uint64_t file_size, uint64_t offset,
+    uint64_t count, size_t size) {
+    return offset <= file_size && count <= (file_size - offset) / size;
+}
+
+/*
+ * Double hashing: probe i uses h1 + i * h2 (h2 odd).
+ */
+template <class T, class Comparator>
+uint64_t
+SortedRun<T, Comparator> :: bloomBit(uint64_t hash, int probe,
+    uint64_t bits) {
+    return (hash + probe * ((hash >> 32) | 1)) % bits;
+}
+
+/*
+ * Open the runs already in dir (created if missing), oldest first, and
+ * start the flush thread. A run whose flushes are all in a merged run is
+ * left over from a compaction cut short (its keys are in the merged run
+ * already), so it is removed.
+ */
+template <class T, class Comparator, class Policy>
+MemTable<T, Comparator, Policy> :: MemTable(const std::string& dir,
+    int limit): dir_(dir), limit_(limit), next_run_(0), flushing_(false),
+    stop_(false), comp_() {
+    std::vector<std::pair<int, int> > found;
+    std::shared_ptr<Run> run;
+    std::string path;
+    struct dirent *entry;
+    DIR *entries;
+    int first, last, covered = -1;
+
+    if (mkdir(dir_.c_str(), 0755) < 0 && errno != EEXIST) {
+        std::cerr << "Standard exception: can't create " << dir_ << '\n';
+    }
+
+    entries = opendir(dir_.c_str());
+    while (entries && (entry = readdir(entries))) {
+        if (sscanf(entry->d_name, "run-%d-%d.skr", &first, &last) == 2 &&
+            0 <= first && first <= last &&
+            runPath(first, last) == dir_ + "/" + entry->d_name) {
+            found.push_back(std::make_pair(first, last));
+        }
+    }
+    if (entries) {
+        closedir(entries);
+    }
+
+    // By first flush, the merged run before the runs it holds
+    std::sort(found.begin(), found.end(),
+        [](const std::pair<int, int>& lhs, const std::pair<int, int>& rhs) {
+            return lhs.first < rhs.first ||
+                (lhs.first == rhs.first && lhs.second > rhs.second);
+        });
+
+    for (size_t i = 0; i < found.size(); ++i) {
+        path = runPath(found[i].first, found[i].second);
+
+        if (found[i].second <= covered) {
+            unlink(path.c_str());
+            continue;
+        }
+
+        covered = found[i].second;
+        next_run_ = covered + 1;
+
+        run = std::make_shared<Run>();
+        if (run->open(path.c_str())) {
+            runs_.push_back(run);
+            ranges_.push_back(found[i]);
+        }
+    }
+
+    flusher_ = std::thread(&MemTable<T, Comparator, Policy>::flushLoop, this);
+}
+
+/*
+ * The keys still in memory are flushed before the thread stops.
+ */
+template <class T, class Comparator, class Policy>
+MemTable<T, Comparator, Policy> :: ~MemTable() {
+    {
+        std::unique_lock<std::mutex> lock(lock_);
+
+        freeze(lock);
+        done_cv_.wait(lock, [this]() { return !flushing_; });
+        stop_ = true;
+    }
+
+    flush_cv_.notify_one();
+    flusher_.join();
+}
+
+/*
+ * Insert count keys in the live list; a full list is frozen (if the
+ * previous one is still being written, the writer waits for it).
+ * O(logn)
+ */
+template <class T, class Comparator, class Policy>
+void
+MemTable<T, Comparator, Policy> :: insertKey(const T& key, int count) {
+    std::unique_lock<std::mutex> lock(lock_);
+
+    live_.insertKey(key, count);
+    if (live_.length() >= limit_) {
+        freeze(lock);
+    }
+}
+
+/*
+ * Count of the key in the live list, the frozen list and all the runs.
+ * The lists are read under the lock, the runs outside it.
+ * O(logn + number of runs), O(log(number of flushes)) runs
+ */
+template <class T, class Comparator, class Policy>
+int
+MemTable<T, Comparator, Policy> :: countKey(const T& key) {
+    std::vector<std::shared_ptr<Run> > runs;
+    int count;
+
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+
+        count = live_.countKey(key) + frozen_.countKey(key);
+        runs = runs_;
+    }
+
+    for (size_t i = 0; i < runs.size(); ++i) {
+        count += runs[i]->countKey(key);
+    }
+
+    return count;
+}
+
+template <class T, class Comparator, class Policy>
+bool
+MemTable<T, Comparator, Policy> :: searchKey(const T& key) {
+    return countKey(key);
+}
+
+/*
+ * Call visit(key, count) for every key in range [lo, hi), in order, with
+ * the counts of all the sources added up. The keys of the lists in range
+ * are copied under the lock, then the lists and the runs are merged with
+ * a heap.
+ * O((k + number of runs) * log(number of runs))
+ */
+template <class T, class Comparator, class Policy>
+template <class Visitor>
+void
+MemTable<T, Comparator, Policy> :: scan(const T& lo, const T& hi,
+    Visitor visit) {
+    typedef typename Run::Entries Entries;
+    typedef std::pair<T, int> Head;  // key, source
+
+    std::vector<std::shared_ptr<Run> > runs;
+    std::vector<typename Run::cursor> cursors;
+    Entries lists[2];
+    size_t pos[2] = {0, 0};
+    T key;
+    int count, source;
+
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        List *sources[2] = {&live_, &frozen_};
+
+        for (int i = 0; i < 2; ++i) {
+            for (auto it = sources[i]->lowerBound(lo);
+                it != sources[i]->end() && comp_(hi, *it); ++it) {
+                lists[i].push_back(std::make_pair(*it, it.count()));
+            }
+        }
+
+        runs = runs_;
+    }
+
+    for (size_t i = 0; i < runs.size(); ++i) {
+        cursors.push_back(runs[i]->seek(lo));
+    }
+
+    // Sources 0 and 1 are the lists, the rest are the runs
+    auto after = [this](const Head& lhs, const Head& rhs) {
+        return comp_(lhs.first, rhs.first);
+    };
+    std::priority_queue<Head, std::vector<Head>, decltype(after)> heap(after);
+
+    auto push = [&](int i) {
+        if (i < 2) {
+            if (pos[i] < lists[i].size()) {
+                heap.push(Head(lists[i][pos[i]].first, i));
+            }
+        } else if (cursors[i - 2].valid() &&
+            comp_(hi, cursors[i - 2].key())) {
+            heap.push(Head(cursors[i - 2].key(), i));
+        }
+    };
+
+    auto take = [&](int i) {
+        int taken;
+
+        if (i < 2) {
+            taken = lists[i][pos[i]++].second;
+        } else {
+            taken = cursors[i - 2].count();
+            cursors[i - 2].next();
+        }
+
+        push(i);
+        return taken;
+    };
+
+    for (int i = 0; i < 2 + static_cast<int>(cursors.size()); ++i) {
+        push(i);
+    }
+
+    while (!heap.empty()) {
+        key = heap.top().first;
+        count = 0;
+
+        while (!heap.empty() && !(heap.top().first != key)) {
+            source = heap.top().second;
+            heap.pop();
+            count += take(source);
+        }
+
+        visit(key, count);
+    }
+}
+
+/*
+ * Freeze the live list and wait until it is on disk.
+ */
+template <class T, class Comparator, class Policy>
+void
+MemTable<T, Comparator, Policy> :: flush() {
+    std::unique_lock<std::mutex> lock(lock_);
+
+    freeze(lock);
+    done_cv_.wait(lock, [this]() { return !flushing_; });
+}
+
+template <class T, class Comparator, class Policy>
+int
+MemTable<T, Comparator, Policy> :: runs() {
+    std::lock_guard<std::mutex> lock(lock_);
+
+    return static_cast<int>(runs_.size());
+}
+
+/*
+ * Swap the live list with the (empty) frozen one and wake the flush
+ * thread. Called with the lock held.
+ * O(1) (+ the wait for the previous flush)
+ */
+template <class T, class Comparator, class Policy>
+void
+MemTable<T, Comparator, Policy> :: freeze(
+    std::unique_lock<std::mutex>& lock) {
+    done_cv_.wait(lock, [this]() { return !flushing_; });
+
+    if (live_.isEmpty()) {
+        return;
+    }
+
+    frozen_ = std::move(live_);
+    flushing_ = true;
+    flush_cv_.notify_one();
+}
+
+/*
+ * Background thread: write the frozen list as a new run, then publish the
+ * run and drop the frozen list in the same critical section, so a reader
+ * sees the keys exactly once. The frozen list doesn't change while it is
+ * written, so it is read without the lock. If the run can't be written
+ * the keys go back to the live list. After a new run the runs are
+ * compacted; the writers don't wait for it (only a second freeze does).
+ */
+template <class T, class Comparator, class Policy>
+void
+MemTable<T, Comparator, Policy> :: flushLoop() {
+    std::unique_lock<std::mutex> lock(lock_);
+    std::shared_ptr<Run> run;
+    std::string path;
+    bool written;
+
+    while (true) {
+        flush_cv_.wait(lock, [this]() { return flushing_ || stop_; });
+        if (!flushing_) {
+            break;
+        }
+
+        path = runPath(next_run_, next_run_);
+        lock.unlock();
+
+        run = std::make_shared<Run>();
+        written = Run::write(path.c_str(), frozen_) &&
+            run->open(path.c_str());
+
+        lock.lock();
+
+        if (written) {
+            runs_.push_back(run);
+            ranges_.push_back(std::make_pair(next_run_, next_run_));
+            ++next_run_;
+        } else {
+            for (auto it = frozen_.begin(); it != frozen_.end(); ++it) {
+                live_.insertKey(*it, it.count());
+            }
+        }
+
+        frozen_.clear();
+        flushing_ = false;
+        done_cv_.notify_all();
+
+        if (written) {
+            compact(lock);
+        }
+    }
+}
+
+/*
+ * Merge the RUN_MERGE_FACTOR newest runs while they hold the same number
+ * of flushes. Only the flush thread changes runs_, so the runs merged are
+ * still the newest when the merged run replaces them (in one critical
+ * section, like a flush). The merged run must hold as many keys as the
+ * runs it replaces, else it is dropped and the runs stay. The old files
+ * are removed last; readers that still use them keep them open. Called
+ * with the lock held.
+ * O(n * log(RUN_MERGE_FACTOR)) for n keys merged
+ */
+template <class T, class Comparator, class Policy>
+void
+MemTable<T, Comparator, Policy> :: compact(
+    std::unique_lock<std::mutex>& lock) {
+    std::vector<std::shared_ptr<Run> > merged;
+    std::vector<std::pair<int, int> > ranges;
+    std::shared_ptr<Run> run;
+    std::string path;
+    int64_t elems;
+    int n;
+    bool written;
+
+    while ((n = static_cast<int>(runs_.size())) >= RUN_MERGE_FACTOR &&
+        sameTier(n - RUN_MERGE_FACTOR)) {
+        merged.assign(runs_.end() - RUN_MERGE_FACTOR, runs_.end());
+        ranges.assign(ranges_.end() - RUN_MERGE_FACTOR, ranges_.end());
+        path = runPath(ranges.front().first, ranges.back().second);
+        lock.unlock();
+
+        elems = 0;
+        for (size_t i = 0; i < merged.size(); ++i) {
+            elems += merged[i]->size();
+        }
+
+        run = std::make_shared<Run>();
+        written = Run::merge(path.c_str(), merged) &&
+            run->open(path.c_str());
+
+        if (written && run->size() != elems) {
+            std::cerr << "Standard exception: keys lost merging " << path
+                << '\n';
+            unlink(path.c_str());
+            written = false;
+        }
+
+        lock.lock();
+
+        if (!written) {
+            return;
+        }
+
+        runs_.erase(runs_.end() - RUN_MERGE_FACTOR, runs_.end());
+        runs_.push_back(run);
+        ranges_.erase(ranges_.end() - RUN_MERGE_FACTOR, ranges_.end());
+        ranges_.push_back(std::make_pair(ranges.front().first,
+            ranges.back().second));
+
+        lock.unlock();
+        for (size_t i = 0; i < ranges.size(); ++i) {
+            unlink(runPath(ranges[i].first, ranges[i].second).c_str());
+        }
+        lock.lock();
+    }
+}
+
+/*
+ * Whether the RUN_MERGE_FACTOR runs from first on hold the same number of
+ * flushes.
+ */
+template <class T, class Comparator, class Policy>
+bool
+MemTable<T, Comparator, Policy> :: sameTier(int first) {
+    int flushes = ranges_[first].second - ranges_[first].first;
+
+    for (int i = first + 1; i < first + RUN_MERGE_FACTOR; ++i) {
+        if (ranges_[i].second - ranges_[i].first != flushes) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+template <class T, class Comparator, class Policy>
+std::string
+MemTable<T, Comparator, Policy> :: runPath(int first, int last) {
+    char name[48];
+
+    snprintf(name, sizeof(name), "/run-%06d-%06d.skr", first, last);
+    return dir_ + name;
+}
+
+#endif  // MEM_TABLE_H_
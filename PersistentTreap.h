@@ -0,0 +1,410 @@
+// Copyright 2019 Nedelcu Horia (nedelcu.horia.alexandru@gmail.com)
+
+/**
+*    Persistent Treap Implementation:
+*
+*    Treap where a node never changes after it is built. insert and erase
+* copy only the nodes on the path they touch (O(logn) of them) and share
+* the rest of the tree with the previous version, then publish the new
+* root. snapshot() takes the current root: a reader keeps a fixed version
+* of the whole tree (find, findK, in order scan) for as long as it wants,
+* with no lock, while the writer goes on.
+*    Nodes are reference counted (std::shared_ptr), so a node is freed when
+* the last version that uses it is dropped. The root is read and replaced
+* atomically (std::atomic<std::shared_ptr> where the library has it, the
+* atomic shared_ptr functions before C++20), so snapshot() may be called
+* from any thread; insert and erase need a single writer at a time.
+*/
+
+#ifndef PERSISTENT_TREAP_H_
+#define PERSISTENT_TREAP_H_
+
+#include <ctime>
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include <iostream>
+
+template <class T>
+struct PersistentNode {
+    typedef std::shared_ptr<const PersistentNode<T> > Ptr;
+
+    T key_;
+    uint32_t priority_;
+    int size_;
+    Ptr left_, right_;
+
+    PersistentNode(const T& key, uint32_t priority, const Ptr& left,
+        const Ptr& right): key_(key), priority_(priority),
+        size_((left? left->size_: 0) + (right? right->size_: 0) + 1),
+        left_(left), right_(right) {}
+};
+
+template <class T>
+class PersistentTreap {
+    typedef typename PersistentNode<T>::Ptr NodePtr;
+
+#if defined(__cpp_lib_atomic_shared_ptr)
+    std::atomic<NodePtr> root_;
+#else
+    NodePtr root_;
+#endif
+    uint32_t rand_;
+
+ public:
+    /*
+     * An immutable version of the tree.
+     */
+    class Snapshot {
+        NodePtr root_;
+
+     public:
+        Snapshot() {}
+        explicit Snapshot(const NodePtr& root): root_(root) {}
+
+        int size() const;
+        bool isEmpty() const;
+        bool find(const T&) const;
+        const T& findK(int k) const;
+
+        template <class Visitor>
+        void forEach(Visitor) const;
+
+     private:
+        template <class Visitor>
+        static void forEach(const PersistentNode<T>*, Visitor&);
+    };
+
+    PersistentTreap();
+
+    int size();
+    bool isEmpty();
+    Snapshot snapshot() const;
+
+    void insert(const T&);
+    void erase(const T&);
+    void clear();
+
+    bool find(const T&);
+    T findK(int k);
+
+ private:
+    NodePtr insert(const NodePtr&, const T&, uint32_t);
+    NodePtr erase(const NodePtr&, const T&);
+    static void split(const NodePtr&, const T&, NodePtr&, NodePtr&);
+    static NodePtr merge(const NodePtr&, const NodePtr&);
+    NodePtr current() const;
+    void publish(const NodePtr&);
+    uint32_t getPriority();
+};
+
+/*
+ * Implementation:
+ */
+
+template <class T>
+int
+PersistentTreap<T> :: Snapshot :: size() const {
+    return root_? root_->size_: 0;
+}
+
+template <class T>
+bool
+PersistentTreap<T> :: Snapshot :: isEmpty() const {
+    return !root_;
+}
+
+/*
+ * O(logn)
+ */
+template <class T>
+bool
+PersistentTreap<T> :: Snapshot :: find(const T& key) const {
+    const PersistentNode<T> *it = root_.get();
+
+    while (it) {
+        if (it->key_ == key) {
+            return true;
+        }
+
+        it = (it->key_ < key)? it->right_.get(): it->left_.get();
+    }
+
+    return false;
+}
+
+/*
+ * The k-th key in order (1 <= k <= size).
+ * O(logn)
+ */
+template <class T>
+const T&
+PersistentTreap<T> :: Snapshot :: findK(int k) const {
+    const PersistentNode<T> *it = root_.get();
+    int left;
+
+    try {
+        if (k < 1 || size() < k) {
+            throw 1;
+        }
+    } catch (...) {
+        std::cerr << "Standard exception: index outside the bounds\n";
+        static const T none = T();
+        return none;
+    }
+
+    while (true) {
+        left = it->left_? it->left_->size_: 0;
+
+        if (k == left + 1) {
+            return it->key_;
+        } else if (k > left + 1) {
+            k -= left + 1;
+            it = it->right_.get();
+        } else {
+            it = it->left_.get();
+        }
+    }
+}
+
+/*
+ * visit(key) for every key, in order.
+ * O(n)
+ */
+template <class T>
+template <class Visitor>
+void
+PersistentTreap<T> :: Snapshot :: forEach(Visitor visit) const {
+    forEach(root_.get(), visit);
+}
+
+template <class T>
+template <class Visitor>
+void
+PersistentTreap<T> :: Snapshot :: forEach(const PersistentNode<T>* node,
+    Visitor& visit) {
+    if (node) {
+        forEach(node->left_.get(), visit);
+        visit(node->key_);
+        forEach(node->right_.get(), visit);
+    }
+}
+
+template <class T>
+PersistentTreap<T> :: PersistentTreap():
+    rand_(static_cast<uint32_t>(time(nullptr)) | 1) {}
+
+/*
+ * The root is read through snapshot(), the writer may be replacing it.
+ */
+template <class T>
+int
+PersistentTreap<T> :: size() {
+    return snapshot().size();
+}
+
+template <class T>
+bool
+PersistentTreap<T> :: isEmpty() {
+    return snapshot().isEmpty();
+}
+
+/*
+ * The current version; it doesn't change with the next updates.
+ * O(1)
+ */
+template <class T>
+typename PersistentTreap<T> :: Snapshot
+PersistentTreap<T> :: snapshot() const {
+    return Snapshot(current());
+}
+
+/*
+ * O(logn) time and new nodes
+ */
+template <class T>
+void
+PersistentTreap<T> :: insert(const T& key) {
+    publish(insert(current(), key, getPriority()));
+}
+
+/*
+ * Erase one copy of key; nothing is copied if key is missing.
+ * O(logn) time and new nodes
+ */
+template <class T>
+void
+PersistentTreap<T> :: erase(const T& key) {
+    NodePtr old_root = current(), root = erase(old_root, key);
+
+    if (root != old_root) {
+        publish(root);
+    }
+}
+
+/*
+ * The nodes stay alive while some snapshot uses them.
+ */
+template <class T>
+void
+PersistentTreap<T> :: clear() {
+    publish(NodePtr());
+}
+
+template <class T>
+bool
+PersistentTreap<T> :: find(const T& key) {
+    return snapshot().find(key);
+}
+
+/*
+ * Returned by value: the snapshot taken here is the only thing that keeps
+ * the node alive, and it is gone once findK returns. Keep a Snapshot to
+ * get references.
+ * O(logn)
+ */
+template <class T>
+T
+PersistentTreap<T> :: findK(int k) {
+    return snapshot().findK(k);
+}
+
+/*
+ * The new node goes where its priority puts it, on the search path of key;
+ * the subtree it takes there is split by key. The nodes above are copied.
+ */
+template <class T>
+typename PersistentTreap<T> :: NodePtr
+PersistentTreap<T> :: insert(const NodePtr& node, const T& key,
+    uint32_t priority) {
+    NodePtr left, right;
+
+    if (!node || node->priority_ < priority) {
+        split(node, key, left, right);
+        return std::make_shared<const PersistentNode<T> >(key, priority, left,
+            right);
+    }
+
+    if (key < node->key_) {
+        return std::make_shared<const PersistentNode<T> >(node->key_,
+            node->priority_, insert(node->left_, key, priority),
+            node->right_);
+    }
+
+    return std::make_shared<const PersistentNode<T> >(node->key_,
+        node->priority_, node->left_, insert(node->right_, key, priority));
+}
+
+/*
+ * Return node itself if key is not in its subtree.
+ */
+template <class T>
+typename PersistentTreap<T> :: NodePtr
+PersistentTreap<T> :: erase(const NodePtr& node, const T& key) {
+    NodePtr child;
+
+    if (!node) {
+        return node;
+    }
+
+    if (node->key_ == key) {
+        return merge(node->left_, node->right_);
+    }
+
+    if (key < node->key_) {
+        child = erase(node->left_, key);
+
+        return (child == node->left_)? node:
+            std::make_shared<const PersistentNode<T> >(node->key_,
+            node->priority_, child, node->right_);
+    }
+
+    child = erase(node->right_, key);
+
+    return (child == node->right_)? node:
+        std::make_shared<const PersistentNode<T> >(node->key_,
+        node->priority_, node->left_, child);
+}
+
+/*
+ * Keys < key go to left, keys >= key to right; the path is copied.
+ */
+template <class T>
+void
+PersistentTreap<T> :: split(const NodePtr& node, const T& key,
+    NodePtr& left, NodePtr& right) {
+    NodePtr part;
+
+    if (!node) {
+        left = right = NodePtr();
+        return;
+    }
+
+    if (node->key_ < key) {
+        split(node->right_, key, part, right);
+        left = std::make_shared<const PersistentNode<T> >(node->key_,
+            node->priority_, node->left_, part);
+    } else {
+        split(node->left_, key, left, part);
+        right = std::make_shared<const PersistentNode<T> >(node->key_,
+            node->priority_, part, node->right_);
+    }
+}
+
+/*
+ * Every key of left is <= every key of right; the spine is copied.
+ */
+template <class T>
+typename PersistentTreap<T> :: NodePtr
+PersistentTreap<T> :: merge(const NodePtr& left, const NodePtr& right) {
+    if (!left || !right) {
+        return left? left: right;
+    }
+
+    if (left->priority_ > right->priority_) {
+        return std::make_shared<const PersistentNode<T> >(left->key_,
+            left->priority_, left->left_, merge(left->right_, right));
+    }
+
+    return std::make_shared<const PersistentNode<T> >(right->key_,
+        right->priority_, merge(left, right->left_), right->right_);
+}
+
+/*
+ * std::atomic_load / std::atomic_store on a shared_ptr are deprecated
+ * since C++20, which has std::atomic<std::shared_ptr> instead.
+ */
+template <class T>
+typename PersistentTreap<T> :: NodePtr
+PersistentTreap<T> :: current() const {
+#if defined(__cpp_lib_atomic_shared_ptr)
+    return root_.load();
+#else
+    return std::atomic_load(&root_);
+#endif
+}
+
+template <class T>
+void
+PersistentTreap<T> :: publish(const NodePtr& root) {
+#if defined(__cpp_lib_atomic_shared_ptr)
+    root_.store(root);
+#else
+    std::atomic_store(&root_, root);
+#endif
+}
+
+/*
+ * xorshift32
+ */
+template <class T>
+uint32_t
+PersistentTreap<T> :: getPriority() {
+    rand_ ^= rand_ << 13;
+    rand_ ^= rand_ >> 17;
+    rand_ ^= rand_ << 5;
+
+    return rand_;
+}
+
+#endif  // PERSISTENT_TREAP_H_
@@ -20,17 +20,47 @@
 #define SKIP_LIST_H_
 
 #include <ctime>
+#include <new>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <iterator>
+#include <thread>
 #include <random>
+#include <vector>
+#include <memory>
+#include <cstddef>
+#include <algorithm>
 #include <iostream>
 #include <exception>
+#include <type_traits>
 
 #define N_MAX 200000
-#define H_MAX 20
+#define H_MAX 32
 #define JUMP_TO_NULL -1
+#define SLAB_SIZE (1 << 16)
+#define SLAB_MIN_SIZE (1 << 10)
+#define SORT_CUTOFF (1 << 15)
+#define BATCH_LANES 8
+#define SNAPSHOT_MAGIC "SKLS"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_LEVELS 64
+
+#if defined(__GNUC__)
+#define PREFETCH_NODE(node) __builtin_prefetch(node)
+#else
+#define PREFETCH_NODE(node)
+#endif
 
 template <class T> class DefaulComparator;
 template <class T> class Node;
-template <class T, class Comparator = DefaulComparator<T> > class SkipList;
+template <class T> class NodePool;
+template <int MaxHeight = H_MAX, int PromoteNum = 1, int PromoteDen = 2,
+    class Random = std::minstd_rand, int Capacity = N_MAX>
+struct SkipListPolicy;
+template <class T, class Comparator = DefaulComparator<T>,
+    class Policy = SkipListPolicy<> > class SkipList;
 
 template <class T>
 class DefaulComparator {
@@ -40,55 +70,223 @@ class DefaulComparator {
     }
 };
 
+/*
+ * The tower of a node is stored right after it, in the same block of
+ * memory, as {next, jump, span} links. This way a hop on any level reads
+ * the link and its counters from one place and the node costs one
+ * allocation. jump counts the nodes skipped by the link, span counts the
+ * keys (count of each skipped node) up to next or up to the end if the
+ * link goes to NULL. prev is the node before on the lowest level (for the
+ * head, the last node of the list or the head itself if it is empty).
+ */
 template <class T>
 class Node {
  public:
+    struct Link {
+        Node<T> *next_;
+        int jump_;
+        int span_;
+    };
+
     T data_;
     int count_;
-    Node **next_;
-    int *jump_;
+    int height_;
+    Node<T> *prev_;
+
+    template <class... Args>
+    Node(int, int, Args&&...);
+
+    Node<T>*& next(int level);
+    int& jump(int level);
+    int& span(int level);
+
+    static size_t bytes(int height);
+
+    /*
+     * The tower lives outside the object, so nodes can't be copied.
+     */
+    Node(const Node<T>&) = delete;
+    Node& operator=(const Node<T>&) = delete;
 
-    Node(T, int, int count_ = 1);
-    Node(Node<T>&);
-    ~Node();
-    Node& operator=(Node<T>&);
+ private:
+    Link* tower();
 };
 
-template <class T, class Comparator>
+/*
+ * Slab allocator for nodes owned by a SkipList. Nodes are cut from large
+ * slabs and the freed ones are kept on a free list for each height (the
+ * size of a node depends only on its height). The first slab takes
+ * SLAB_MIN_SIZE bytes and each new one twice the last, up to SLAB_SIZE, so
+ * a small list stays small. All the memory is released at once when the
+ * pool is destroyed. Pools can share slabs (see share): a slab is released
+ * by the last pool that holds it.
+ */
+template <class T>
+class NodePool {
+    /*
+     * The slabs of a group of pools. A group joined to a larger one gives
+     * it its slabs and keeps a link to it, so the pools that still hold
+     * the small group reach the common one by following the links.
+     */
+    struct Slabs {
+        std::vector<char*> slabs_;
+        std::shared_ptr<Slabs> parent_;
+
+        ~Slabs();
+    };
+
+    std::shared_ptr<Slabs> slabs_;
+    std::vector<void*> free_;
+    char *cursor_;
+    size_t left_;
+    size_t slab_size_;
+
+ public:
+    NodePool();
+
+    NodePool(const NodePool<T>&) = delete;
+    NodePool& operator=(const NodePool<T>&) = delete;
+
+    template <class... Args>
+    Node<T>* newNode(int, int, Args&&...);
+    void deleteNode(Node<T>*);
+    void swap(NodePool<T>&) noexcept;
+    void share(NodePool<T>&);
+
+ private:
+    void* allocate(int height);
+    std::shared_ptr<Slabs>& group();
+};
+
+/*
+ * Shape of a skip list, fixed at compile time:
+ * MaxHeight - the number of levels, enough for about (1 / p) ^ MaxHeight
+ *     nodes (only the levels in use are searched);
+ * PromoteNum / PromoteDen - the probability p for a node to get one more
+ *     level (1 / 2 default);
+ * Random - the generator used for heights;
+ * Capacity - what capacity() reports.
+ */
+template <int MaxHeight, int PromoteNum, int PromoteDen, class Random,
+    int Capacity>
+struct SkipListPolicy {
+    static const int kMaxHeight = MaxHeight;
+    static const int kPromoteNum = PromoteNum;
+    static const int kPromoteDen = PromoteDen;
+    static const int kCapacity = Capacity;
+    typedef Random random_type;
+
+    static int newHeight(Random&);
+};
+
+/*
+ * Header of a skip list snapshot (see save). After it come the keys, the
+ * counts and the heights of the nodes in order, then one lane for each
+ * level above the first: {node, down} pairs where node is the index of a
+ * node that reaches the level and down is its position in the lane below
+ * (the index itself for level 1). Offsets are from the start of the file.
+ */
+struct SkipListFileHeader {
+    char magic_[4];
+    uint32_t version_;
+    uint32_t key_size_;
+    uint32_t levels_;
+    uint64_t num_nodes_;
+    uint64_t num_elem_;
+    uint64_t keys_offset_;
+    uint64_t counts_offset_;
+    uint64_t heights_offset_;
+    uint64_t lane_offset_[SNAPSHOT_LEVELS];
+    uint64_t lane_size_[SNAPSHOT_LEVELS];
+};
+
+struct SkipListFileLane {
+    uint32_t node_;
+    uint32_t down_;
+};
+
+template <class T, class Comparator, class Policy>
 class SkipList {
-    int max_capacity_;
-    int max_height_;
+    int level_;
     int num_elem_;
     int num_nodes_;
-    int *index_path_;
-    Node<T> **path_, *head_;
+    // Pops not yet applied to the head (see settleHead)
+    mutable int pop_nodes_, pop_elems_, top_pops_;
+    mutable int pop_nodes_mark_[Policy::kMaxHeight];
+    mutable int pop_elems_mark_[Policy::kMaxHeight];
+    int index_path_[Policy::kMaxHeight];
+    int elem_path_[Policy::kMaxHeight];
+    bool finger_mode_;
+    Node<T> *path_[Policy::kMaxHeight], *head_, *finger_;
+    NodePool<T> pool_;
     Comparator comp_;
-    std::minstd_rand new_rand_;
+    typename Policy::random_type new_rand_;
+
+    // The head lives in the list itself, so an empty list allocates
+    // nothing (a bound on Node::bytes(kMaxHeight))
+    typename std::aligned_storage<sizeof(Node<T>)
+        + alignof(typename Node<T>::Link)
+        + Policy::kMaxHeight * sizeof(typename Node<T>::Link),
+        (alignof(Node<T>) > alignof(typename Node<T>::Link))?
+        alignof(Node<T>): alignof(typename Node<T>::Link)>::type head_space_;
 
  public:
     SkipList();
-    SkipList(const SkipList<T, Comparator>&);
+    SkipList(const SkipList<T, Comparator, Policy>&);
+    SkipList(SkipList<T, Comparator, Policy>&&) noexcept;
+    template <class InputIterator>
+    SkipList(InputIterator, InputIterator);
     ~SkipList();
-    SkipList<T, Comparator>& operator=(const SkipList<T, Comparator>&);
-
+    SkipList<T, Comparator, Policy>&
+    operator=(const SkipList<T, Comparator, Policy>&);
+    SkipList<T, Comparator, Policy>&
+    operator=(SkipList<T, Comparator, Policy>&&) noexcept;
+    void swap(SkipList<T, Comparator, Policy>&) noexcept;
+
+    /*
+     * Keys can't be changed through an iterator, so iterator and
+     * const_iterator are the same type. head is needed to step back
+     * from end.
+     */
     class iterator {
-        Node<T>* itr;
+        friend class SkipList<T, Comparator, Policy>;
+        Node<T> *itr, *head;
 
      public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef T value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const T* pointer;
+        typedef const T& reference;
+
         iterator();
-        explicit iterator(Node<T>*);
+        iterator(Node<T>*, Node<T>*);
         iterator(const iterator&);
 
         iterator& operator=(const iterator&);
-        bool operator==(const iterator&);
-        bool operator!=(const iterator&);
+        bool operator==(const iterator&) const;
+        bool operator!=(const iterator&) const;
         iterator& operator++();
-        const T& operator*();
+        iterator operator++(int);
+        iterator& operator--();
+        iterator operator--(int);
+        const T& operator*() const;
+        const T* operator->() const;
+        int count() const;
     };
 
-    iterator begin();
-    iterator end();
+    typedef iterator const_iterator;
+    typedef std::reverse_iterator<iterator> reverse_iterator;
+    typedef reverse_iterator const_reverse_iterator;
+
+    iterator begin() const;
+    iterator end() const;
+    reverse_iterator rbegin() const;
+    reverse_iterator rend() const;
     iterator findKey(const T&);
+    iterator at(int index);
+    iterator advance(iterator, int);
+    int distance(iterator, iterator);
 
     int size();
     int length();
@@ -96,14 +294,57 @@ class SkipList {
     bool isEmpty();
 
     int countKey(const T&);
+    void countKeys(const T*, int, int*);
     bool searchKey(const T&);
     void insertKey(const T&, int count_ = 1);
+    void insertKey(T&&, int count_ = 1);
+    iterator insertKey(iterator, const T&, int count_ = 1);
+    template <class... Args>
+    void emplaceKey(Args&&...);
+    void setFingerMode(bool);
     void eraseKey(const T&, int count_ = 1);
+    void replaceKey(const T&, const T&);
+
+    template <class InputIterator>
+    void assign(InputIterator, InputIterator);
+    void clear();
+    void eraseRange(const T&, const T&);
+    void eraseIndexRange(int, int);
+    SkipList<T, Comparator, Policy> splitAt(const T&);
+    void concat(SkipList<T, Comparator, Policy>&);
+
+    iterator lowerBound(const T&);
+    iterator upperBound(const T&);
+    int rank(const T&);
+    int rankElements(const T&);
+    int countRange(const T&, const T&);
+    int countRangeElements(const T&, const T&);
 
     const T& topKey();
+    void pushKey(const T&, int count_ = 1);
+    T popTop();
     const T& operator[](int index);
+    const T& elementAt(int index);
+
+    bool save(const char*);
 
  private:
+    void countSortedKeys(const T*, int, int*);
+    void countInterleavedKeys(const T*, int, int*);
+    Node<T>* findLast(const T&, bool, int*, int*);
+    Node<T>* findIndex(int);
+    int indexOf(iterator);
+    void findPath(const T&, bool);
+    void findIndexPath(int);
+    void cutRange(Node<T>**, int*, int*);
+    template <class Key>
+    Node<T>* insertNode(Key&&, int, bool);
+    Node<T>* addCount(Node<T>*, int);
+    void removeCount(Node<T>*, int);
+    Node<T>* linkNode(Node<T>*);
+    void copyFrom(const SkipList<T, Comparator, Policy>&);
+    void relinkHead();
+    void settleHead() const;
     int getNewHeight();
 };
 
@@ -111,98 +352,304 @@ class SkipList {
  * Implementation:
  */
 
+/*
+ * The key is built in place from args (copied, moved or emplaced).
+ */
 template <class T>
-Node<T> :: Node(T data, int height, int count): data_(data),
-    count_(count), next_(nullptr), jump_(nullptr) {
-    try {
-        next_ = new Node<T>*[height]();
-        jump_ = new int[height]();
+template <class... Args>
+Node<T> :: Node(int height, int count, Args&&... args):
+    data_(std::forward<Args>(args)...), count_(count), height_(height),
+    prev_(nullptr) {
+    for (int i = 0; i < height; ++i) {
+        next(i) = nullptr;
+        jump(i) = JUMP_TO_NULL;
+        span(i) = 0;
+    }
+}
 
-        for (int i = 0; i < height; ++i) {
-            jump_[i] = JUMP_TO_NULL;
-        }
-    } catch (std::exception& e) {
-        std::cerr << "Standard exception: " << e.what() << '\n';
+template <class T>
+Node<T>*&
+Node<T> :: next(int level) {
+    return tower()[level].next_;
+}
+
+template <class T>
+int&
+Node<T> :: jump(int level) {
+    return tower()[level].jump_;
+}
+
+template <class T>
+int&
+Node<T> :: span(int level) {
+    return tower()[level].span_;
+}
+
+/*
+ * Size of a node with its tower, rounded so that consecutive
+ * nodes cut from the same slab stay aligned.
+ */
+template <class T>
+size_t
+Node<T> :: bytes(int height) {
+    const size_t align = alignof(Node<T>) > alignof(Link)?
+        alignof(Node<T>): alignof(Link);
+    const size_t offset = (sizeof(Node<T>) + alignof(Link) - 1)
+        / alignof(Link) * alignof(Link);
+
+    return (offset + height * sizeof(Link) + align - 1) / align * align;
+}
+
+template <class T>
+typename Node<T> :: Link*
+Node<T> :: tower() {
+    const size_t offset = (sizeof(Node<T>) + alignof(Link) - 1)
+        / alignof(Link) * alignof(Link);
+
+    return reinterpret_cast<Link*>(reinterpret_cast<char*>(this) + offset);
+}
+
+template <class T>
+NodePool<T> :: Slabs :: ~Slabs() {
+    for (char *slab : slabs_) {
+        ::operator delete(slab);
     }
 }
 
 template <class T>
-Node<T> :: ~Node() {
-    delete[] next_;
-    delete[] jump_;
+NodePool<T> :: NodePool(): cursor_(nullptr), left_(0),
+    slab_size_(SLAB_MIN_SIZE) {}
+
+template <class T>
+template <class... Args>
+Node<T>*
+NodePool<T> :: newNode(int height, int count, Args&&... args) {
+    return new (allocate(height)) Node<T>(height, count,
+        std::forward<Args>(args)...);
 }
 
 /*
- * These are shallow copy assignments and constructor (Rule of three).
- * Each node doesn't preserve its height, because it doesn't need and
- * it is a waste of memory.
+ * Exchange the slabs of two pools (the nodes keep their memory).
  */
 template <class T>
-Node<T> :: Node(Node<T>& other) = default;
+void
+NodePool<T> :: swap(NodePool<T>& other) noexcept {
+    slabs_.swap(other.slabs_);
+    free_.swap(other.free_);
+    std::swap(cursor_, other.cursor_);
+    std::swap(left_, other.left_);
+    std::swap(slab_size_, other.slab_size_);
+}
 
+/*
+ * Hold the slabs of other too, so nodes cut from them can be moved to the
+ * skip list of this pool (split / concatenate). Each pool keeps allocating
+ * from its own slab and frees into its own free lists. The two groups of
+ * slabs become one: the smaller one moves, so a slab moves at most
+ * O(log(number of slabs)) times, and pools that already share (a list
+ * split and concatenated back) don't move any.
+ * O(1) amortized per slab
+ */
 template <class T>
-Node<T>& Node<T> :: operator=(Node<T>& other) = default;
+void
+NodePool<T> :: share(NodePool<T>& other) {
+    std::shared_ptr<Slabs> mine = group(), theirs = other.group();
 
-template <class T, class Comparator>
-SkipList<T, Comparator> :: iterator ::
-iterator(): itr(nullptr) {}
+    if (mine == theirs) {
+        return;
+    }
 
-template <class T, class Comparator>
-SkipList<T, Comparator> :: iterator ::
-iterator(Node<T>* other_itr): itr(other_itr) {}
+    if (mine->slabs_.size() < theirs->slabs_.size()) {
+        mine.swap(theirs);
+    }
 
-template <class T, class Comparator>
-SkipList<T, Comparator> :: iterator ::
-iterator(const iterator& other): itr(other.itr) {}
+    mine->slabs_.insert(mine->slabs_.end(), theirs->slabs_.begin(),
+        theirs->slabs_.end());
+    theirs->slabs_.clear();
+    theirs->parent_ = mine;
 
-template <class T, class Comparator>
-typename SkipList<T, Comparator> :: iterator&
-SkipList<T, Comparator> :: iterator ::
+    slabs_ = mine;
+    other.slabs_ = mine;
+}
+
+template <class T>
+void
+NodePool<T> :: deleteNode(Node<T>* node) {
+    int height = node->height_;
+    void *block = node;
+
+    node->~Node<T>();
+
+    // The node may come from a pool that shares its slabs with this one
+    if (static_cast<int>(free_.size()) < height) {
+        free_.resize(height, nullptr);
+    }
+
+    *static_cast<void**>(block) = free_[height - 1];
+    free_[height - 1] = block;
+}
+
+template <class T>
+void*
+NodePool<T> :: allocate(int height) {
+    size_t size = Node<T>::bytes(height);
+    void *block;
+
+    if (static_cast<int>(free_.size()) < height) {
+        free_.resize(height, nullptr);
+    }
+
+    if (free_[height - 1]) {
+        block = free_[height - 1];
+        free_[height - 1] = *static_cast<void**>(block);
+        return block;
+    }
+
+    if (left_ < size) {
+        left_ = std::max(size, slab_size_);
+        slab_size_ = std::min<size_t>(2 * slab_size_, SLAB_SIZE);
+        cursor_ = static_cast<char*>(::operator new(left_));
+        group()->slabs_.push_back(cursor_);
+    }
+
+    block = cursor_;
+    cursor_ += size;
+    left_ -= size;
+
+    return block;
+}
+
+/*
+ * The group that holds the slabs now (the pool moves up to it). A pool
+ * gets its group with its first slab, so an unused pool allocates nothing.
+ */
+template <class T>
+std::shared_ptr<typename NodePool<T>::Slabs>&
+NodePool<T> :: group() {
+    std::shared_ptr<Slabs> parent;
+
+    if (!slabs_) {
+        slabs_ = std::make_shared<Slabs>();
+    }
+
+    while (slabs_->parent_) {
+        parent = slabs_->parent_;
+        slabs_.swap(parent);
+    }
+
+    return slabs_;
+}
+
+template <class T, class Comparator, class Policy>
+SkipList<T, Comparator, Policy> :: iterator ::
+iterator(): itr(nullptr), head(nullptr) {}
+
+template <class T, class Comparator, class Policy>
+SkipList<T, Comparator, Policy> :: iterator ::
+iterator(Node<T>* other_itr, Node<T>* other_head): itr(other_itr),
+    head(other_head) {}
+
+template <class T, class Comparator, class Policy>
+SkipList<T, Comparator, Policy> :: iterator ::
+iterator(const iterator& other): itr(other.itr), head(other.head) {}
+
+template <class T, class Comparator, class Policy>
+typename SkipList<T, Comparator, Policy> :: iterator&
+SkipList<T, Comparator, Policy> :: iterator ::
 operator=(const iterator& other) {
     itr = other.itr;
+    head = other.head;
     return *this;
 }
 
-template <class T, class Comparator>
+template <class T, class Comparator, class Policy>
 bool
-SkipList<T, Comparator> :: iterator ::
-operator== (const iterator& other) {
+SkipList<T, Comparator, Policy> :: iterator ::
+operator== (const iterator& other) const {
     return itr == other.itr;
 }
 
-template <class T, class Comparator>
+template <class T, class Comparator, class Policy>
 bool
-SkipList<T, Comparator> :: iterator ::
-operator!= (const iterator& other) {
+SkipList<T, Comparator, Policy> :: iterator ::
+operator!= (const iterator& other) const {
     return itr != other.itr;
 }
 
-template <class T, class Comparator>
-typename SkipList<T, Comparator> :: iterator&
-SkipList<T, Comparator> :: iterator ::
+template <class T, class Comparator, class Policy>
+typename SkipList<T, Comparator, Policy> :: iterator&
+SkipList<T, Comparator, Policy> :: iterator ::
 operator++() {
-    itr = itr->next_[0];
+    itr = itr->next(0);
     return *this;
 }
 
-template <class T, class Comparator>
+template <class T, class Comparator, class Policy>
+typename SkipList<T, Comparator, Policy> :: iterator
+SkipList<T, Comparator, Policy> :: iterator ::
+operator++(int) {
+    iterator tmp(*this);
+
+    itr = itr->next(0);
+    return tmp;
+}
+
+/*
+ * From end go to the last node (prev of the head).
+ */
+template <class T, class Comparator, class Policy>
+typename SkipList<T, Comparator, Policy> :: iterator&
+SkipList<T, Comparator, Policy> :: iterator ::
+operator--() {
+    itr = itr? itr->prev_: head->prev_;
+    return *this;
+}
+
+template <class T, class Comparator, class Policy>
+typename SkipList<T, Comparator, Policy> :: iterator
+SkipList<T, Comparator, Policy> :: iterator ::
+operator--(int) {
+    iterator tmp(*this);
+
+    --*this;
+    return tmp;
+}
+
+template <class T, class Comparator, class Policy>
 const T&
-SkipList<T, Comparator> :: iterator ::
-operator*() {
+SkipList<T, Comparator, Policy> :: iterator ::
+operator*() const {
     return itr->data_;
 }
 
-template <class T, class Comparator>
-SkipList<T, Comparator> :: SkipList(): max_capacity_(N_MAX), max_height_(H_MAX),
-    num_elem_(0), num_nodes_(0), index_path_(nullptr), path_(nullptr),
-    head_(nullptr), comp_(), new_rand_() {
+template <class T, class Comparator, class Policy>
+const T*
+SkipList<T, Comparator, Policy> :: iterator ::
+operator->() const {
+    return &itr->data_;
+}
+
+/*
+ * How many times the key of the current node is in the skip list.
+ */
+template <class T, class Comparator, class Policy>
+int
+SkipList<T, Comparator, Policy> :: iterator ::
+count() const {
+    return itr->count_;
+}
+
+template <class T, class Comparator, class Policy>
+SkipList<T, Comparator, Policy> :: SkipList(): level_(1), num_elem_(0),
+    num_nodes_(0), pop_nodes_(0), pop_elems_(0), top_pops_(0),
+    pop_nodes_mark_(), pop_elems_mark_(), finger_mode_(false),
+    head_(nullptr), finger_(nullptr), comp_(), new_rand_() {
     unsigned int seed = static_cast<unsigned int>(time(nullptr));
     T tmp = T();
 
     try {
-        head_ = new Node<T>(tmp, max_height_);
-        path_ = new Node<T>*[max_height_];
-        index_path_ = new int[max_height_]();
+        head_ = new (&head_space_) Node<T>(Policy::kMaxHeight, 0, tmp);
+        head_->prev_ = head_;
     } catch (std::exception& e) {
         std::cerr << "Standard exception: " << e.what() << '\n';
     }
@@ -210,90 +657,142 @@ SkipList<T, Comparator> :: SkipList(): max_capacity_(N_MAX), max_height_(H_MAX),
     new_rand_.seed(seed);
 }
 
-template <class T, class Comparator>
-SkipList<T, Comparator> :: SkipList(const SkipList<T, Comparator>& other):
-    max_capacity_(other.max_capacity_), max_height_(other.max_height_),
-    num_elem_(other.num_elem_), num_nodes_(other.num_nodes_),
-    index_path_(nullptr), path_(nullptr), head_(nullptr),
-    comp_(), new_rand_() {
-    unsigned int seed = static_cast<unsigned int>(time(nullptr));
-    T tmp = T();
-
-    try {
-        head_ = new Node<T>(tmp, max_height_);
-        path_ = new Node<T>*[max_height_];
-        index_path_ = new int[max_height_]();
-    } catch (std::exception& e) {
-        std::cerr << "Standard exception: " << e.what() << '\n';
-    }
+/*
+ * The copy has the same towers, ranks and counts as other.
+ * O(n)
+ */
+template <class T, class Comparator, class Policy>
+SkipList<T, Comparator, Policy> ::
+SkipList(const SkipList<T, Comparator, Policy>& other): SkipList() {
+    finger_mode_ = other.finger_mode_;
+    copyFrom(other);
+}
 
-    SkipList<T, Comparator> :: iterator it;
-    for (it = other.begin(); it != other.end(); ++it) {
-        this->insertKey(*it);
-    }
+/*
+ * Take the nodes of other, which is left empty. Nothing is allocated: the
+ * new list starts empty with its own head and the links of the heads are
+ * exchanged.
+ * O(MaxHeight)
+ */
+template <class T, class Comparator, class Policy>
+SkipList<T, Comparator, Policy> ::
+SkipList(SkipList<T, Comparator, Policy>&& other) noexcept: SkipList() {
+    swap(other);
+}
 
-    new_rand_.seed(seed);
+/*
+ * Build the skip list from a range sorted in the order of the list
+ * (see assign).
+ */
+template <class T, class Comparator, class Policy>
+template <class InputIterator>
+SkipList<T, Comparator, Policy> ::
+SkipList(InputIterator first, InputIterator last): SkipList() {
+    assign(first, last);
 }
 
-template <class T, class Comparator>
-SkipList<T, Comparator> :: ~SkipList() {
+/*
+ * The nodes are released all at once together with the pool,
+ * only the keys that need it are destroyed one by one.
+ */
+template <class T, class Comparator, class Policy>
+SkipList<T, Comparator, Policy> :: ~SkipList() {
     Node<T>* tmp;
 
-    while (head_) {
+    while (!std::is_trivially_destructible<T>::value && head_) {
         tmp = head_;
-        head_ = head_->next_[0];
-        delete tmp;
+        head_ = head_->next(0);
+        tmp->~Node<T>();
     }
-
-    delete[] path_;
-    delete[] index_path_;
 }
 
-template <class T, class Comparator>
-SkipList<T, Comparator>&
-SkipList<T, Comparator> :: operator=(const SkipList<T, Comparator>& other) {
-    Node<T>* tmp_node;
-
-    while (head_) {
-        tmp_node = head_;
-        head_ = head_->next_[0];
-        delete tmp_node;
+/*
+ * O(n)
+ */
+template <class T, class Comparator, class Policy>
+SkipList<T, Comparator, Policy>&
+SkipList<T, Comparator, Policy> ::
+operator=(const SkipList<T, Comparator, Policy>& other) {
+    if (this != &other) {
+        clear();
+        finger_mode_ = other.finger_mode_;
+        copyFrom(other);
     }
 
-    delete[] path_;
-    delete[] index_path_;
-
-    max_capacity_ = other.max_capacity_;
-    max_height_ = other.max_height_;
-    num_elem_ = other.num_elem_;
-    num_nodes_ = other.num_nodes_;
+    return *this;
+}
 
-    T tmp = T();
+/*
+ * The nodes are exchanged, the old ones go away with other.
+ * O(MaxHeight)
+ */
+template <class T, class Comparator, class Policy>
+SkipList<T, Comparator, Policy>&
+SkipList<T, Comparator, Policy> ::
+operator=(SkipList<T, Comparator, Policy>&& other) noexcept {
+    swap(other);
+    return *this;
+}
 
-    try {
-        head_ = new Node<T>(tmp, max_height_);
-        path_ = new Node<T>*[max_height_];
-        index_path_ = new int[max_height_]();
-    } catch (std::exception& e) {
-        std::cerr << "Standard exception: " << e.what() << '\n';
+/*
+ * Iterators on nodes follow their nodes to the other list, end() stays
+ * with its list.
+ * O(MaxHeight)
+ */
+template <class T, class Comparator, class Policy>
+void
+SkipList<T, Comparator, Policy> ::
+swap(SkipList<T, Comparator, Policy>& other) noexcept {
+    if (this == &other) {
+        return;
     }
 
-    SkipList<T, Comparator> :: iterator it;
-    for (it = other.begin(); it != other.end(); ++it) {
-        this->insertKey(*it);
+    settleHead();
+    other.settleHead();
+    std::swap(level_, other.level_);
+    std::swap(num_elem_, other.num_elem_);
+    std::swap(num_nodes_, other.num_nodes_);
+    std::swap(finger_mode_, other.finger_mode_);
+    pool_.swap(other.pool_);
+    std::swap(comp_, other.comp_);
+    std::swap(new_rand_, other.new_rand_);
+
+    // Each list keeps its head, only the links move
+    for (int i = 0; i < Policy::kMaxHeight; ++i) {
+        std::swap(head_->next(i), other.head_->next(i));
+        std::swap(head_->jump(i), other.head_->jump(i));
+        std::swap(head_->span(i), other.head_->span(i));
     }
+    std::swap(head_->prev_, other.head_->prev_);
+    relinkHead();
+    other.relinkHead();
+
+    // The paths went through the other head
+    finger_ = other.finger_ = nullptr;
 }
 
-template <class T, class Comparator>
-typename SkipList<T, Comparator> :: iterator
-SkipList<T, Comparator> :: begin() {
-    return iterator(head_->next_[0]);
+template <class T, class Comparator, class Policy>
+typename SkipList<T, Comparator, Policy> :: iterator
+SkipList<T, Comparator, Policy> :: begin() const {
+    return iterator(head_->next(0), head_);
 }
 
-template <class T, class Comparator>
-typename SkipList<T, Comparator> :: iterator
-SkipList<T, Comparator> :: end() {
-    return iterator(nullptr);
+template <class T, class Comparator, class Policy>
+typename SkipList<T, Comparator, Policy> :: iterator
+SkipList<T, Comparator, Policy> :: end() const {
+    return iterator(nullptr, head_);
+}
+
+template <class T, class Comparator, class Policy>
+typename SkipList<T, Comparator, Policy> :: reverse_iterator
+SkipList<T, Comparator, Policy> :: rbegin() const {
+    return reverse_iterator(end());
+}
+
+template <class T, class Comparator, class Policy>
+typename SkipList<T, Comparator, Policy> :: reverse_iterator
+SkipList<T, Comparator, Policy> :: rend() const {
+    return reverse_iterator(begin());
 }
 
 /*
@@ -301,45 +800,108 @@ SkipList<T, Comparator> :: end() {
  * position or end iterator otherwise.
  * O(logn)
  */
-template <class T, class Comparator>
-typename SkipList<T, Comparator> :: iterator
-SkipList<T, Comparator> :: findKey(const T& key) {
+template <class T, class Comparator, class Policy>
+typename SkipList<T, Comparator, Policy> :: iterator
+SkipList<T, Comparator, Policy> :: findKey(const T& key) {
     Node<T> *it = head_;
 
-    for (int i = max_height_ - 1; i > -1; --i) {
-        while (it->next_[i] && comp_(key, it->next_[i]->data_)) {
-            it = it->next_[i];
+    for (int i = level_ - 1; i > -1; --i) {
+        while (it->next(i) && comp_(key, it->next(i)->data_)) {
+            it = it->next(i);
         }
     }
 
-    if (!it->next_[0] || key != it->next_[0]->data_) {
-        return iterator(nullptr);
+    if (!it->next(0) || key != it->next(0)->data_) {
+        return end();
     } else {
-        return iterator(it->next_[0]);
+        return iterator(it->next(0), head_);
     }
 }
 
-template <class T, class Comparator>
+/*
+ * Iterator to position index (end for index = length).
+ * O(logn)
+ */
+template <class T, class Comparator, class Policy>
+typename SkipList<T, Comparator, Policy> :: iterator
+SkipList<T, Comparator, Policy> :: at(int index) {
+    try {
+        if (index < 0 || num_nodes_ < index) {
+            throw 1;
+        }
+    } catch (...) {
+        std::cerr << "Standard exception: index outside the bounds\n";
+        return end();
+    }
+
+    return (index == num_nodes_)? end(): iterator(findIndex(index), head_);
+}
+
+/*
+ * Iterator k positions after it (before it for negative k). Forward the
+ * search climbs the towers met on the way, taking the highest link that
+ * doesn't jump past the target, like a search from a finger. Backward
+ * there are no links, so it goes again from the head by index.
+ * O(logk) forward, O(logn) backward
+ */
+template <class T, class Comparator, class Policy>
+typename SkipList<T, Comparator, Policy> :: iterator
+SkipList<T, Comparator, Policy> :: advance(iterator it, int k) {
+    Node<T> *node = it.itr;
+    int i;
+
+    if (k < 0 || !node) {
+        return at(indexOf(it) + k);
+    }
+
+    while (k > 0) {
+        for (i = node->height_ - 1; i > 0 &&
+            (!node->next(i) || node->jump(i) + 1 > k); --i) {
+        }
+
+        if (!node->next(i)) {
+            // Only end is left after the last node
+            return (k == 1)? end(): at(num_nodes_ + k);
+        }
+
+        k -= node->jump(i) + 1;
+        node = node->next(i);
+    }
+
+    return iterator(node, head_);
+}
+
+/*
+ * Number of positions from first to last (negative if last is before).
+ * O(logn)
+ */
+template <class T, class Comparator, class Policy>
 int
-SkipList<T, Comparator> :: size() {
+SkipList<T, Comparator, Policy> :: distance(iterator first, iterator last) {
+    return indexOf(last) - indexOf(first);
+}
+
+template <class T, class Comparator, class Policy>
+int
+SkipList<T, Comparator, Policy> :: size() {
     return num_elem_;
 }
 
-template <class T, class Comparator>
+template <class T, class Comparator, class Policy>
 int
-SkipList<T, Comparator> :: length() {
+SkipList<T, Comparator, Policy> :: length() {
     return num_nodes_;
 }
 
-template <class T, class Comparator>
+template <class T, class Comparator, class Policy>
 int
-SkipList<T, Comparator> :: capacity() {
-    return max_capacity_;
+SkipList<T, Comparator, Policy> :: capacity() {
+    return Policy::kCapacity;
 }
 
-template <class T, class Comparator>
+template <class T, class Comparator, class Policy>
 bool
-SkipList<T, Comparator> :: isEmpty() {
+SkipList<T, Comparator, Policy> :: isEmpty() {
     return num_nodes_ == 0;
 }
 
@@ -348,186 +910,668 @@ SkipList<T, Comparator> :: isEmpty() {
  * times the key is on the skip list.
  * O(logn)
  */
-template <class T, class Comparator>
+template <class T, class Comparator, class Policy>
 int
-SkipList<T, Comparator> :: countKey(const T& key) {
+SkipList<T, Comparator, Policy> :: countKey(const T& key) {
     Node<T> *it = head_;
 
-    for (int i = max_height_ - 1; i > -1; --i) {
-        while (it->next_[i] && comp_(key, it->next_[i]->data_)) {
-            it = it->next_[i];
+    for (int i = level_ - 1; i > -1; --i) {
+        while (it->next(i) && comp_(key, it->next(i)->data_)) {
+            it = it->next(i);
         }
     }
 
-    if (!it->next_[0] || key != it->next_[0]->data_) {
+    if (!it->next(0) || key != it->next(0)->data_) {
         return 0;
     } else {
-        return it->next_[0]->count_;
+        return it->next(0)->count_;
     }
 }
 
-template <class T, class Comparator>
+/*
+ * Count a batch of keys: out[i] = countKey(keys[i]). A sorted batch reuses
+ * the path of the previous key, otherwise several searches are run at once
+ * so their cache misses overlap.
+ * O(nlogn)
+ */
+template <class T, class Comparator, class Policy>
+void
+SkipList<T, Comparator, Policy> :: countKeys(const T* keys, int n, int* out) {
+    bool sorted = true;
+
+    for (int i = 1; sorted && i < n; ++i) {
+        sorted = !comp_(keys[i - 1], keys[i]);
+    }
+
+    if (sorted) {
+        countSortedKeys(keys, n, out);
+    } else {
+        countInterleavedKeys(keys, n, out);
+    }
+}
+
+template <class T, class Comparator, class Policy>
 bool
-SkipList<T, Comparator> :: searchKey(const T& key) {
+SkipList<T, Comparator, Policy> :: searchKey(const T& key) {
     return countKey(key);
 }
 
 /*
  * Insert count keys in the skip list (count = 1 default).
- * O(logn)
+ * O(logn), O(logd) in finger mode (d = distance to the previous insertion)
  */
-template <class T, class Comparator>
+template <class T, class Comparator, class Policy>
 void
-SkipList<T, Comparator> :: insertKey(const T& key, int count) {
-    try {
-        if (count < 1) {
-            throw 1;
-        }
-    } catch (...) {
-        std::cerr << "Standard exception: insertKey negative number of keys\n";
-        return;
-    }
+SkipList<T, Comparator, Policy> :: insertKey(const T& key, int count) {
+    insertNode(key, count, finger_mode_);
+}
 
-    num_elem_ += count;
+/*
+ * The key is moved into the new node (left alone if it was already there).
+ * O(logn)
+ */
+template <class T, class Comparator, class Policy>
+void
+SkipList<T, Comparator, Policy> :: insertKey(T&& key, int count) {
+    insertNode(std::move(key), count, finger_mode_);
+}
 
-    int height, curr_index, old_jump;
-    Node<T> *tmp, *node, *it;
+/*
+ * Insert a key built in place from args. The node is made first, so if the
+ * key is already there the node is given back to the pool.
+ * O(logn)
+ */
+template <class T, class Comparator, class Policy>
+template <class... Args>
+void
+SkipList<T, Comparator, Policy> :: emplaceKey(Args&&... args) {
+    Node<T> *node, *found;
 
-    if (!searchKey(key)) {
-        ++num_nodes_;
+    node = pool_.newNode(getNewHeight(), 1, std::forward<Args>(args)...);
+    findPath(node->data_, finger_mode_);
 
-        height = getNewHeight();
-        curr_index = 0;
+    found = path_[0]->next(0);
+    if (found && !(node->data_ != found->data_)) {
+        addCount(found, 1);
+        pool_.deleteNode(node);
+    } else {
+        linkNode(node);
+    }
+}
 
-        node = new Node<T>(key, height, count);
-        it = head_;
+/*
+ * Insert count keys using the position of a previous insertion as hint.
+ * If hint is the iterator returned by the last insertion and the key comes
+ * after it, the search starts from the saved path instead of the head.
+ * Return an iterator to the inserted key.
+ * O(logd) for a good hint, O(logn) otherwise
+ */
+template <class T, class Comparator, class Policy>
+typename SkipList<T, Comparator, Policy> :: iterator
+SkipList<T, Comparator, Policy> ::
+insertKey(iterator hint, const T& key, int count) {
+    return iterator(insertNode(key, count, finger_ && hint.itr == finger_),
+        head_);
+}
 
-        for (int i = max_height_ - 1; i > -1; --i) {
-            while (it->next_[i] && comp_(key, it->next_[i]->data_)) {
-                curr_index += it->jump_[i] + 1;
-                it = it->next_[i];
-            }
+/*
+ * In finger mode every insertion starts from the path of the previous one,
+ * which makes sorted and near-sorted streams of keys cheap to insert.
+ */
+template <class T, class Comparator, class Policy>
+void
+SkipList<T, Comparator, Policy> :: setFingerMode(bool finger_mode) {
+    finger_mode_ = finger_mode;
+}
 
-            // For each level retain the last node and its position in skiplist
-            // jump_ specify the node level how many nodes skip
-            index_path_[i] = curr_index;
-            path_[i] = it;
+/*
+ * Erase count keys from the skip list (count = 1 default).
+ * O(logn)
+ */
+template <class T, class Comparator, class Policy>
+void
+SkipList<T, Comparator, Policy> :: eraseKey(const T& key, int count) {
+    try {
+        if (count < 1) {
+            throw 1;
         }
+    } catch (...) {
+        std::cerr << "Standard exception: eraseKey negative number of keys\n";
+        return;
+    }
 
+    Node<T> *it = head_;
 
-        // Nodes at the same height point to the
-        // new node levels and change their jump_
-        tmp = path_[0]->next_[0];
-        path_[0]->next_[0] = node;
-        node->next_[0] = tmp;
-
-        old_jump = path_[0]->jump_[0];
-        path_[0]->jump_[0] = 0;
-        node->jump_[0] = old_jump;  // 0 or JUMP_TO_NULL
-
-        for (int i = 1; i < height; ++i) {
-            tmp = path_[i]->next_[i];
-            path_[i]->next_[i] = node;
-            node->next_[i] = tmp;
-
-            old_jump = path_[i]->jump_[i];
-            // The current node jumps as many nodes as it reaches the node on a
-            // lower level path + as many nodes as it reaches the node inserted
-            path_[i]->jump_[i] = index_path_[i - 1] - index_path_[i]
-                + path_[i - 1]->jump_[i - 1];
-            // The inserted node jumps over remained nodes or jumps to NULL
-            node->jump_[i] = (old_jump == JUMP_TO_NULL)? JUMP_TO_NULL:
-                old_jump - path_[i]->jump_[i];
-        }
+    // The path is overwritten and its nodes may be erased
+    finger_ = nullptr;
+    settleHead();
 
-        // The rest of the path with higher levels jump over an extra node
-        for (int i = height; i < max_height_; ++i) {
-            if (path_[i]->jump_[i] != JUMP_TO_NULL) {
-                ++path_[i]->jump_[i];
-            }
+    for (int i = level_ - 1; i > -1; --i) {
+        while (it->next(i) && comp_(key, it->next(i)->data_)) {
+            it = it->next(i);
         }
-    } else {
-        it = head_;
 
-        for (int i = max_height_ - 1; i > -1; --i) {
-            while (it->next_[i] && comp_(key, it->next_[i]->data_)) {
-                it = it->next_[i];
-            }
-        }
+        path_[i] = it;
+    }
 
-        it->next_[0]->count_ += count;
+    if (it->next(0) && !(key != it->next(0)->data_)) {
+        removeCount(it->next(0), count);
     }
 }
 
 /*
- * Erase count keys from the skip list (count = 1 default).
+ * Erase one copy of old_key and insert one copy of new_key (a sample
+ * leaving a window and the one coming in). Both paths are found in the
+ * same descent: the finger of the later key starts on each level from
+ * where the finger of the earlier key stopped, if that is further. The
+ * later key is changed first, it doesn't touch the nodes before it, so the
+ * path of the earlier key is still valid afterwards.
  * O(logn)
  */
-template <class T, class Comparator>
+template <class T, class Comparator, class Policy>
 void
-SkipList<T, Comparator> :: eraseKey(const T& key, int count) {
-    try {
-        if (count < 1) {
-            throw 1;
+SkipList<T, Comparator, Policy> :: replaceKey(const T& old_key,
+    const T& new_key) {
+    if (!(old_key != new_key)) {
+        if (!countKey(new_key)) {
+            insertKey(new_key);
         }
-    } catch (...) {
-        std::cerr << "Standard exception: eraseKey negative number of keys\n";
+
         return;
     }
 
-    int get_count = countKey(key);
-    Node<T> *tmp, *it = head_;
+    bool old_first = comp_(new_key, old_key);
+    const T& first = old_first? old_key: new_key;
+    const T& last = old_first? new_key: old_key;
+    Node<T> *first_path[Policy::kMaxHeight], *it = head_, *node;
+    int first_index[Policy::kMaxHeight], first_elem[Policy::kMaxHeight];
+    int levels = level_, curr_index = 0, curr_elem = 0;
 
-    if (get_count < 1) {
-        return;
+    settleHead();
+
+    finger_ = nullptr;
+
+    for (int i = level_ - 1; i > -1; --i) {
+        while (it->next(i) && comp_(first, it->next(i)->data_)) {
+            curr_index += it->jump(i) + 1;
+            curr_elem += it->span(i) + it->next(i)->count_;
+            it = it->next(i);
+        }
+
+        first_path[i] = it;
+        first_index[i] = curr_index;
+        first_elem[i] = curr_elem;
+
+        if (i == level_ - 1 || index_path_[i + 1] < curr_index) {
+            path_[i] = it;
+            index_path_[i] = curr_index;
+            elem_path_[i] = curr_elem;
+        } else {
+            path_[i] = path_[i + 1];
+            index_path_[i] = index_path_[i + 1];
+            elem_path_[i] = elem_path_[i + 1];
+        }
+
+        while (path_[i]->next(i) && comp_(last, path_[i]->next(i)->data_)) {
+            index_path_[i] += path_[i]->jump(i) + 1;
+            elem_path_[i] += path_[i]->span(i) + path_[i]->next(i)->count_;
+            path_[i] = path_[i]->next(i);
+        }
     }
 
-    for (int i = max_height_ - 1; i > -1; --i) {
-        while (it->next_[i] && comp(key, it->next_[i]->data_)) {
-            it = it->next_[i];
+    for (int k = 0; k < 2; ++k) {
+        const T& key = (k == 0)? last: first;
+
+        node = path_[0]->next(0);
+        if (old_first == (k == 1)) {
+            if (node && !(key != node->data_)) {
+                removeCount(node, 1);
+            }
+        } else if (node && !(key != node->data_)) {
+            addCount(node, 1);
+        } else {
+            linkNode(pool_.newNode(getNewHeight(), 1, key));
         }
 
-        path_[i] = it;
+        // Back to the path of the earlier key (head on new levels)
+        for (int i = 0; k == 0 && i < level_; ++i) {
+            path_[i] = (i < levels)? first_path[i]: head_;
+            index_path_[i] = (i < levels)? first_index[i]: 0;
+            elem_path_[i] = (i < levels)? first_elem[i]: 0;
+        }
     }
 
-    if (it->next_[0]->count_ > count) {
-        num_elem_ -= count;
-    } else {
-        num_elem_ -= it->next_[0]->count_;
+    finger_ = nullptr;
+}
+
+/*
+ * Take count keys (all if there are less) from node, the one after the
+ * path: the levels above it skip less keys and the node is unlinked when
+ * its count gets to zero.
+ */
+template <class T, class Comparator, class Policy>
+void
+SkipList<T, Comparator, Policy> :: removeCount(Node<T>* tmp, int count) {
+    if (tmp->count_ < count) {
+        count = tmp->count_;
     }
 
-    it->next_[0]->count_ -= count;
-    if (it->next_[0]->count_ < 1) {
+    num_elem_ -= count;
+    tmp->count_ -= count;
+
+    if (tmp->count_ > 0) {
+        // The levels above the node skip less keys
+        for (int i = tmp->height_; i < level_; ++i) {
+            path_[i]->span(i) -= count;
+        }
+    } else {
         --num_nodes_;
 
-        tmp = it->next_[0];
+        if (tmp->next(0)) {
+            tmp->next(0)->prev_ = tmp->prev_;
+        } else {
+            head_->prev_ = tmp->prev_;
+        }
 
-        for (int i = 0; i < max_height_; ++i) {
-            if (path_[i]->next_[i] != tmp) {
+        for (int i = 0; i < level_; ++i) {
+            if (path_[i]->next(i) != tmp) {
             	// jump less with one node
-                if (path_[i]->next_[i]) {
+                if (path_[i]->next(i)) {
                 	// no jump to NULL
-                    --path_[i]->jump_[i];
+                    --path_[i]->jump(i);
                 }
+
+                path_[i]->span(i) -= count;
             } else {
-                path_[i]->next_[i] = tmp->next_[i];
+                path_[i]->next(i) = tmp->next(i);
 
                 // check if now jump to NULL
-                if (path_[i]->next_[i]) {
-                    path_[i]->jump_[i] += tmp->jump_[i];
+                if (path_[i]->next(i)) {
+                    path_[i]->jump(i) += tmp->jump(i);
                 } else {
-                    path_[i]->jump_[i] = JUMP_TO_NULL;
+                    path_[i]->jump(i) = JUMP_TO_NULL;
                 }
+
+                path_[i]->span(i) += tmp->span(i);
             }
         }
 
-        delete tmp;
+        pool_.deleteNode(tmp);
+
+        // Drop the levels left empty
+        while (level_ > 1 && !head_->next(level_ - 1)) {
+            --level_;
+        }
     }
 }
 
-template <class T, class Comparator>
+/*
+ * Replace the content with the keys from a sorted range. The nodes are
+ * appended from left to right: path keeps the last node of each level and
+ * index_path its position, so the jump of a level is known as soon as the
+ * next node of that level arrives. Equal consecutive keys only increase
+ * the count of the last node. If the range turns out not to be sorted,
+ * the rest of it is inserted one key at a time.
+ * O(n) for a sorted range
+ */
+template <class T, class Comparator, class Policy>
+template <class InputIterator>
+void
+SkipList<T, Comparator, Policy> ::
+assign(InputIterator first, InputIterator last) {
+    int height, index = 0;
+    Node<T> *node, *prev = nullptr;
+
+    clear();
+
+    // Until the list is complete elem_path keeps the number of keys before
+    // each node on the path (its count can still grow)
+    for (int i = 0; i < Policy::kMaxHeight; ++i) {
+        path_[i] = head_;
+        index_path_[i] = 0;
+        elem_path_[i] = 0;
+    }
+
+    for (; first != last; ++first) {
+        if (prev && !(*first != prev->data_)) {
+            ++prev->count_;
+            ++num_elem_;
+            continue;
+        }
+
+        if (prev && comp_(prev->data_, *first)) {
+            std::cerr << "Standard exception: assign range is not sorted\n";
+            break;
+        }
+
+        height = getNewHeight();
+        node = pool_.newNode(height, 1, *first);
+        ++index;
+
+        if (height > level_) {
+            level_ = height;
+        }
+
+        node->prev_ = path_[0];
+        for (int i = 0; i < height; ++i) {
+            path_[i]->next(i) = node;
+            path_[i]->jump(i) = index - index_path_[i] - 1;
+            path_[i]->span(i) = num_elem_ - elem_path_[i] - path_[i]->count_;
+            path_[i] = node;
+            index_path_[i] = index;
+            elem_path_[i] = num_elem_;
+        }
+
+        ++num_nodes_;
+        ++num_elem_;
+        prev = node;
+    }
+
+    // The last link of each level spans up to the end
+    for (int i = 0; i < level_; ++i) {
+        elem_path_[i] += path_[i]->count_;
+        path_[i]->span(i) = num_elem_ - elem_path_[i];
+    }
+    head_->prev_ = path_[0];
+
+    // The path now ends on the last key, good finger for appending
+    finger_ = prev;
+
+    for (; first != last; ++first) {
+        insertKey(*first);
+    }
+}
+
+/*
+ * Erase all the keys, the head node is kept.
+ * O(n)
+ */
+template <class T, class Comparator, class Policy>
+void
+SkipList<T, Comparator, Policy> :: clear() {
+    Node<T> *tmp, *it = head_->next(0);
+
+    settleHead();
+
+    while (it) {
+        tmp = it;
+        it = it->next(0);
+        pool_.deleteNode(tmp);
+    }
+
+    for (int i = 0; i < level_; ++i) {
+        head_->next(i) = nullptr;
+        head_->jump(i) = JUMP_TO_NULL;
+        head_->span(i) = 0;
+    }
+    head_->prev_ = head_;
+
+    num_elem_ = 0;
+    num_nodes_ = 0;
+    level_ = 1;
+    finger_ = nullptr;
+}
+
+/*
+ * Erase all the keys in range [lo, hi) with their counts. The paths of lo
+ * and hi are the boundaries of the cut (see cutRange).
+ * O(logn) for the unlinking + O(k) to free the k nodes
+ */
+template <class T, class Comparator, class Policy>
+void
+SkipList<T, Comparator, Policy> :: eraseRange(const T& lo, const T& hi) {
+    Node<T> *left[Policy::kMaxHeight];
+    int left_index[Policy::kMaxHeight], left_elem[Policy::kMaxHeight];
+
+    findPath(lo, false);
+    for (int i = 0; i < level_; ++i) {
+        left[i] = path_[i];
+        left_index[i] = index_path_[i];
+        left_elem[i] = elem_path_[i];
+    }
+
+    findPath(hi, false);
+    cutRange(left, left_index, left_elem);
+}
+
+/*
+ * Erase the nodes at positions [first, last) with their counts.
+ * O(logn) for the unlinking + O(k) to free the k nodes
+ */
+template <class T, class Comparator, class Policy>
+void
+SkipList<T, Comparator, Policy> :: eraseIndexRange(int first, int last) {
+    try {
+        if (first < 0 || last < first || num_nodes_ < last) {
+            throw 1;
+        }
+    } catch (...) {
+        std::cerr << "Standard exception: index outside the bounds\n";
+        return;
+    }
+
+    Node<T> *left[Policy::kMaxHeight];
+    int left_index[Policy::kMaxHeight], left_elem[Policy::kMaxHeight];
+
+    findIndexPath(first);
+    for (int i = 0; i < level_; ++i) {
+        left[i] = path_[i];
+        left_index[i] = index_path_[i];
+        left_elem[i] = elem_path_[i];
+    }
+
+    findIndexPath(last);
+    cutRange(left, left_index, left_elem);
+}
+
+/*
+ * Move the keys that are not before key in a new skip list, returned. The
+ * levels are cut after the path of key: the head of the new list takes the
+ * links that were leaving the path. The two lists share the slabs of the
+ * nodes (see NodePool::share).
+ * O(logn)
+ */
+template <class T, class Comparator, class Policy>
+SkipList<T, Comparator, Policy>
+SkipList<T, Comparator, Policy> :: splitAt(const T& key) {
+    SkipList<T, Comparator, Policy> other;
+    Node<T> *next, *tail = head_->prev_;
+    int index, elems;
+
+    findPath(key, false);
+    index = index_path_[0];
+    elems = elem_path_[0];
+
+    for (int i = 0; i < level_; ++i) {
+        next = path_[i]->next(i);
+
+        other.head_->next(i) = next;
+        other.head_->jump(i) = next? index_path_[i] + path_[i]->jump(i)
+            - index: JUMP_TO_NULL;
+        other.head_->span(i) = elem_path_[i] + path_[i]->span(i) - elems;
+
+        path_[i]->next(i) = nullptr;
+        path_[i]->jump(i) = JUMP_TO_NULL;
+        path_[i]->span(i) = elems - elem_path_[i];
+    }
+
+    if (other.head_->next(0)) {
+        other.head_->next(0)->prev_ = other.head_;
+        other.head_->prev_ = tail;
+    }
+    head_->prev_ = path_[0];
+
+    other.level_ = level_;
+    other.num_nodes_ = num_nodes_ - index;
+    other.num_elem_ = num_elem_ - elems;
+    other.finger_mode_ = finger_mode_;
+    other.comp_ = comp_;
+    other.pool_.share(pool_);
+
+    num_nodes_ = index;
+    num_elem_ = elems;
+    finger_ = nullptr;
+
+    // Drop the levels left empty in both lists
+    while (level_ > 1 && !head_->next(level_ - 1)) {
+        --level_;
+    }
+    while (other.level_ > 1 && !other.head_->next(other.level_ - 1)) {
+        --other.level_;
+    }
+
+    return other;
+}
+
+/*
+ * Append the nodes of other, whose keys must all come after the keys of
+ * this list; other is left empty. The last node of each level is linked
+ * to the first node of the same level in other. If the keys overlap they
+ * are inserted one at a time.
+ * O(logn) (O(mlogn) for overlapping keys)
+ */
+template <class T, class Comparator, class Policy>
+void
+SkipList<T, Comparator, Policy> ::
+concat(SkipList<T, Comparator, Policy>& other) {
+    if (this == &other || other.num_nodes_ == 0) {
+        return;
+    }
+
+    Node<T> *it, *next;
+    int levels = std::max(level_, other.level_);
+
+    if (num_nodes_ &&
+        !comp_(other.head_->next(0)->data_, head_->prev_->data_)) {
+        std::cerr << "Standard exception: concat keys are not after\n";
+
+        for (it = other.head_->next(0); it; it = it->next(0)) {
+            insertKey(it->data_, it->count_);
+        }
+        other.clear();
+        return;
+    }
+
+    // The last node of each level, its position and the keys up to it
+    other.settleHead();
+    findPath(other.head_->next(0)->data_, false);
+    for (int i = level_; i < levels; ++i) {
+        path_[i] = head_;
+        index_path_[i] = 0;
+        elem_path_[i] = 0;
+    }
+
+    for (int i = 0; i < levels; ++i) {
+        if (i < other.level_) {
+            next = other.head_->next(i);
+            path_[i]->next(i) = next;
+            path_[i]->jump(i) = next? num_nodes_ - index_path_[i]
+                + other.head_->jump(i): JUMP_TO_NULL;
+            path_[i]->span(i) = num_elem_ - elem_path_[i]
+                + other.head_->span(i);
+        } else {
+            path_[i]->span(i) = num_elem_ - elem_path_[i] + other.num_elem_;
+        }
+    }
+
+    other.head_->next(0)->prev_ = head_->prev_;
+    head_->prev_ = other.head_->prev_;
+    pool_.share(other.pool_);
+
+    level_ = levels;
+    num_nodes_ += other.num_nodes_;
+    num_elem_ += other.num_elem_;
+    finger_ = nullptr;
+
+    // The nodes belong to this list now
+    for (int i = 0; i < other.level_; ++i) {
+        other.head_->next(i) = nullptr;
+        other.head_->jump(i) = JUMP_TO_NULL;
+        other.head_->span(i) = 0;
+    }
+    other.head_->prev_ = other.head_;
+    other.num_nodes_ = 0;
+    other.num_elem_ = 0;
+    other.level_ = 1;
+    other.finger_ = nullptr;
+}
+
+/*
+ * Iterator to the first key that is not before key
+ * (end iterator if there is none).
+ * O(logn)
+ */
+template <class T, class Comparator, class Policy>
+typename SkipList<T, Comparator, Policy> :: iterator
+SkipList<T, Comparator, Policy> :: lowerBound(const T& key) {
+    return iterator(findLast(key, false, nullptr, nullptr)->next(0), head_);
+}
+
+/*
+ * Iterator to the first key that comes after key
+ * (end iterator if there is none).
+ * O(logn)
+ */
+template <class T, class Comparator, class Policy>
+typename SkipList<T, Comparator, Policy> :: iterator
+SkipList<T, Comparator, Policy> :: upperBound(const T& key) {
+    return iterator(findLast(key, true, nullptr, nullptr)->next(0), head_);
+}
+
+/*
+ * Number of nodes (distinct keys) before key.
+ * O(logn)
+ */
+template <class T, class Comparator, class Policy>
+int
+SkipList<T, Comparator, Policy> :: rank(const T& key) {
+    int index;
+
+    findLast(key, false, &index, nullptr);
+    return index;
+}
+
+/*
+ * Number of keys (with their counts) before key.
+ * O(logn)
+ */
+template <class T, class Comparator, class Policy>
+int
+SkipList<T, Comparator, Policy> :: rankElements(const T& key) {
+    int elems;
+
+    findLast(key, false, nullptr, &elems);
+    return elems;
+}
+
+/*
+ * Number of nodes (distinct keys) in range [lo, hi).
+ * O(logn)
+ */
+template <class T, class Comparator, class Policy>
+int
+SkipList<T, Comparator, Policy> :: countRange(const T& lo, const T& hi) {
+    int count = rank(hi) - rank(lo);
+
+    return (count > 0)? count: 0;
+}
+
+/*
+ * Number of keys (with their counts) in range [lo, hi).
+ * O(logn)
+ */
+template <class T, class Comparator, class Policy>
+int
+SkipList<T, Comparator, Policy> ::
+countRangeElements(const T& lo, const T& hi) {
+    int count = rankElements(hi) - rankElements(lo);
+
+    return (count > 0)? count: 0;
+}
+
+template <class T, class Comparator, class Policy>
 const T&
-SkipList<T, Comparator> :: topKey() {
+SkipList<T, Comparator, Policy> :: topKey() {
     try {
         if (num_nodes_ < 1) {
             throw 1;
@@ -536,16 +1580,88 @@ SkipList<T, Comparator> :: topKey() {
         std::cerr << "Standard exception: empty list\n";
     }
 
-    return head_->next_[0]->data_;
+    return head_->next(0)->data_;
+}
+
+/*
+ * Priority queue interface: the top is the first key in the order of
+ * the skip list.
+ * O(logn)
+ */
+template <class T, class Comparator, class Policy>
+void
+SkipList<T, Comparator, Policy> :: pushKey(const T& key, int count) {
+    insertKey(key, count);
+}
+
+/*
+ * Remove one copy of the first key and return it. The first node hangs
+ * right after the head, so there is no search: its links are handed to
+ * the head. The levels above it only count one key less, which is left
+ * for the next search to apply (see settleHead).
+ * O(1) expected
+ */
+template <class T, class Comparator, class Policy>
+T
+SkipList<T, Comparator, Policy> :: popTop() {
+    try {
+        if (num_nodes_ < 1) {
+            throw 1;
+        }
+    } catch (...) {
+        std::cerr << "Standard exception: empty list\n";
+        return T();
+    }
+
+    Node<T> *node = head_->next(0);
+
+    // The keys up to the nodes of the path change
+    finger_ = nullptr;
+    --num_elem_;
+
+    ++pop_elems_;
+
+    if (--node->count_ > 0) {
+        ++top_pops_;
+        return node->data_;
+    }
+
+    T key = std::move(node->data_);
+
+    --num_nodes_;
+    ++pop_nodes_;
+    top_pops_ = 0;
+    for (int i = 0; i < node->height_; ++i) {
+        head_->next(i) = node->next(i);
+        head_->jump(i) = node->jump(i);
+        head_->span(i) = node->span(i);
+        pop_nodes_mark_[i] = pop_nodes_;
+        pop_elems_mark_[i] = pop_elems_;
+    }
+
+    if (head_->next(0)) {
+        head_->next(0)->prev_ = head_;
+    } else {
+        head_->prev_ = head_;
+    }
+
+    pool_.deleteNode(node);
+
+    // Drop the levels left empty
+    while (level_ > 1 && !head_->next(level_ - 1)) {
+        --level_;
+    }
+
+    return key;
 }
 
 /*
  * Return date from position index in skip list.
  * O(logn)
  */
-template <class T, class Comparator>
+template <class T, class Comparator, class Policy>
 const T&
-SkipList<T, Comparator> :: operator[](int index) {
+SkipList<T, Comparator, Policy> :: operator[](int index) {
     try {
         if (index < 0 || num_nodes_ <= index) {
             throw 1;
@@ -554,94 +1670,873 @@ SkipList<T, Comparator> :: operator[](int index) {
         std::cerr << "Standard exception: index outside the bounds\n";
     }
 
-    ++index;
+    return findIndex(index)->data_;
+}
+
+/*
+ * Return the key at position index when every copy of a key is counted
+ * (index in [0, size)), like in the sorted sequence of all the keys.
+ * O(logn)
+ */
+template <class T, class Comparator, class Policy>
+const T&
+SkipList<T, Comparator, Policy> :: elementAt(int index) {
+    try {
+        if (index < 0 || num_elem_ <= index) {
+            throw 1;
+        }
+    } catch (...) {
+        std::cerr << "Standard exception: index outside the bounds\n";
+    }
+
+    Node<T> *next, *it = head_;
+    int curr_elem = 0;
+
+    settleHead();
+
+    // curr_elem counts the keys up to it (with its own)
+    for (int i = level_ - 1; i > -1; --i) {
+        while ((next = it->next(i)) &&
+            curr_elem + it->span(i) + next->count_ <= index) {
+            curr_elem += it->span(i) + next->count_;
+            it = next;
+        }
+    }
+
+    return it->next(0)->data_;
+}
+
+/*
+ * The keys come in order, so the path of a key (last node before it on
+ * each level) is a finger for the next one: go up only while the next node
+ * on the level is still before the key, then down as usual.
+ * O(logd) for each key (d = distance to the previous key)
+ */
+template <class T, class Comparator, class Policy>
+void
+SkipList<T, Comparator, Policy> ::
+countSortedKeys(const T* keys, int n, int* out) {
+    std::vector<Node<T>*> path(level_, head_);
+    Node<T> *it, *next;
+    int level;
+
+    for (int k = 0; k < n; ++k) {
+        for (level = 0; level < level_ - 1 && path[level]->next(level) &&
+            comp_(keys[k], path[level]->next(level)->data_); ++level) {
+        }
+
+        for (it = path[level]; level > -1; --level) {
+            while ((next = it->next(level)) && comp_(keys[k], next->data_)) {
+                it = next;
+            }
+
+            path[level] = it;
+        }
+
+        next = it->next(0);
+        out[k] = (!next || keys[k] != next->data_)? 0: next->count_;
+    }
+}
+
+/*
+ * Up to BATCH_LANES searches are in flight. Each one makes a single hop and
+ * prefetches the node it will read next, then the following search gets a
+ * turn, so by the time a search comes back its node is (likely) in cache.
+ * O(logn) for each key
+ */
+template <class T, class Comparator, class Policy>
+void
+SkipList<T, Comparator, Policy> :: countInterleavedKeys(const T* keys, int n,
+    int* out) {
+    Node<T> *it[BATCH_LANES], *next;
+    int key[BATCH_LANES], level[BATCH_LANES];
+    int lanes = 0, issued = 0;
+
+    for (; lanes < BATCH_LANES && issued < n; ++lanes, ++issued) {
+        it[lanes] = head_;
+        key[lanes] = issued;
+        level[lanes] = level_ - 1;
+        PREFETCH_NODE(head_->next(level_ - 1));
+    }
+
+    while (lanes > 0) {
+        for (int j = 0; j < lanes; ++j) {
+            const T& curr = keys[key[j]];
+
+            next = it[j]->next(level[j]);
+            if (next && comp_(curr, next->data_)) {
+                it[j] = next;
+                PREFETCH_NODE(next->next(level[j]));
+                continue;
+            }
+
+            if (level[j] > 0) {
+                --level[j];
+                PREFETCH_NODE(it[j]->next(level[j]));
+                continue;
+            }
+
+            out[key[j]] = (!next || curr != next->data_)? 0: next->count_;
+
+            // The lane takes the next key or is dropped
+            if (issued < n) {
+                it[j] = head_;
+                key[j] = issued++;
+                level[j] = level_ - 1;
+            } else {
+                --lanes;
+                it[j] = it[lanes];
+                key[j] = key[lanes];
+                level[j] = level[lanes];
+                --j;
+            }
+        }
+    }
+}
+
+/*
+ * Write a flat snapshot of the skip list to path, to be served from
+ * memory by MappedSkipList. The keys are copied byte by byte, so they must
+ * be trivially copyable. Return false if the file couldn't be written.
+ * O(n)
+ */
+template <class T, class Comparator, class Policy>
+bool
+SkipList<T, Comparator, Policy> :: save(const char* path) {
+    static_assert(std::is_trivially_copyable<T>::value,
+        "save needs keys that can be copied byte by byte");
+    static_assert(Policy::kMaxHeight <= SNAPSHOT_LEVELS,
+        "too many levels for the snapshot header");
+
+    std::vector<std::vector<SkipListFileLane> > lanes(level_);
+    std::vector<int32_t> counts;
+    std::vector<unsigned char> heights;
+    SkipListFileHeader header;
+    SkipListFileLane lane;
+    uint64_t offset;
+    bool written;
+    FILE *file;
+
+    counts.reserve(num_nodes_);
+    heights.reserve(num_nodes_);
+
+    for (Node<T> *it = head_->next(0); it; it = it->next(0)) {
+        lane.node_ = static_cast<uint32_t>(counts.size());
+        lane.down_ = lane.node_;
+
+        for (int i = 1; i < it->height_; ++i) {
+            lanes[i].push_back(lane);
+            lane.down_ = static_cast<uint32_t>(lanes[i].size() - 1);
+        }
+
+        counts.push_back(it->count_);
+        heights.push_back(static_cast<unsigned char>(it->height_));
+    }
+
+    auto align = [](uint64_t pos) { return (pos + 7) / 8 * 8; };
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic_, SNAPSHOT_MAGIC, 4);
+    header.version_ = SNAPSHOT_VERSION;
+    header.key_size_ = sizeof(T);
+    header.levels_ = level_;
+    header.num_nodes_ = counts.size();
+    header.num_elem_ = num_elem_;
+    header.keys_offset_ = align(sizeof(header));
+    header.counts_offset_ = align(header.keys_offset_
+        + counts.size() * sizeof(T));
+    header.heights_offset_ = header.counts_offset_
+        + counts.size() * sizeof(int32_t);
+
+    offset = align(header.heights_offset_ + heights.size());
+    for (int i = 1; i < level_; ++i) {
+        header.lane_offset_[i] = offset;
+        header.lane_size_[i] = lanes[i].size();
+        offset += lanes[i].size() * sizeof(SkipListFileLane);
+    }
+
+    file = fopen(path, "wb");
+    if (!file) {
+        std::cerr << "Standard exception: can't open " << path << '\n';
+        return false;
+    }
+
+    const char padding[8] = {0};
+    auto pad = [&](uint64_t pos) {
+        long size = ftell(file);
+        return size >= 0 && fwrite(padding, 1, pos - size, file)
+            == pos - size;
+    };
+
+    written = fwrite(&header, sizeof(header), 1, file) == 1
+        && pad(header.keys_offset_);
+
+    for (Node<T> *it = head_->next(0); written && it; it = it->next(0)) {
+        written = fwrite(&it->data_, sizeof(T), 1, file) == 1;
+    }
+
+    auto write = [&](const void* data, size_t size, size_t count) {
+        return count == 0 || fwrite(data, size, count, file) == count;
+    };
+
+    written = written && pad(header.counts_offset_)
+        && write(counts.data(), sizeof(int32_t), counts.size())
+        && write(heights.data(), 1, heights.size());
+
+    for (int i = 1; written && i < level_; ++i) {
+        written = pad(header.lane_offset_[i])
+            && write(lanes[i].data(), sizeof(SkipListFileLane),
+                lanes[i].size());
+    }
+
+    written = (fclose(file) == 0) && written;
+    if (!written) {
+        std::cerr << "Standard exception: can't write " << path << '\n';
+    }
+
+    return written;
+}
+
+/*
+ * Return the last node before key (or the last one not after key if
+ * inclusive) and count on the way the nodes and the keys up to it.
+ * It doesn't touch the path, so the finger stays valid.
+ */
+template <class T, class Comparator, class Policy>
+Node<T>*
+SkipList<T, Comparator, Policy> :: findLast(const T& key, bool inclusive,
+    int* index, int* elems) {
+    int curr_index = 0, curr_elem = 0;
+    Node<T> *next, *it = head_;
+
+    settleHead();
+    for (int i = level_ - 1; i > -1; --i) {
+        while ((next = it->next(i)) && (inclusive?
+            !comp_(next->data_, key): comp_(key, next->data_))) {
+            curr_index += it->jump(i) + 1;
+            curr_elem += it->span(i) + next->count_;
+            it = next;
+        }
+    }
+
+    if (index) {
+        *index = curr_index;
+    }
+    if (elems) {
+        *elems = curr_elem;
+    }
+
+    return it;
+}
+
+/*
+ * Fill path / index_path / elem_path for key: for each level the last node
+ * before key, its position in skip list and the keys up to it. With
+ * use_finger and a key after the last inserted one, the search goes up from
+ * the saved path only as long as the next node on the level is still before
+ * key, then goes down from there (the levels above keep their nodes, they
+ * already are before key).
+ */
+template <class T, class Comparator, class Policy>
+void
+SkipList<T, Comparator, Policy> :: findPath(const T& key, bool use_finger) {
+    int level = level_ - 1, curr_index = 0, curr_elem = 0;
     Node<T> *it = head_;
-    for (int i = max_height_ - 1; i > -1; --i) {
-        while (it->next_[i] && index >= it->jump_[i] + 1) {
-            index -= it->jump_[i] + 1;
-            it = it->next_[i];
+
+    settleHead();
+    if (use_finger && finger_ && comp_(key, finger_->data_)) {
+        level = 0;
+
+        while (level < level_ - 1 && path_[level]->next(level) &&
+            comp_(key, path_[level]->next(level)->data_)) {
+            ++level;
         }
+
+        it = path_[level];
+        curr_index = index_path_[level];
+        curr_elem = elem_path_[level];
     }
 
-    return it->data_;
+    for (int i = level; i > -1; --i) {
+        while (it->next(i) && comp_(key, it->next(i)->data_)) {
+            curr_index += it->jump(i) + 1;
+            curr_elem += it->span(i) + it->next(i)->count_;
+            it = it->next(i);
+        }
+
+        // For each level retain the last node, its position in skiplist
+        // and the number of keys up to it (jump specify the node level how
+        // many nodes skip, span how many keys)
+        index_path_[i] = curr_index;
+        elem_path_[i] = curr_elem;
+        path_[i] = it;
+    }
 }
 
-template <class T, class Comparator>
+/*
+ * Fill path / index_path / elem_path with the last node among the first
+ * count nodes on each level.
+ */
+template <class T, class Comparator, class Policy>
+void
+SkipList<T, Comparator, Policy> :: findIndexPath(int count) {
+    int curr_index = 0, curr_elem = 0;
+    Node<T> *it = head_;
+
+    settleHead();
+    for (int i = level_ - 1; i > -1; --i) {
+        while (it->next(i) && curr_index + it->jump(i) + 1 <= count) {
+            curr_index += it->jump(i) + 1;
+            curr_elem += it->span(i) + it->next(i)->count_;
+            it = it->next(i);
+        }
+
+        index_path_[i] = curr_index;
+        elem_path_[i] = curr_elem;
+        path_[i] = it;
+    }
+}
+
+/*
+ * Unlink the nodes between two paths: left (with its positions and keys)
+ * is the last node before the range on each level, path the last node in
+ * the range. A level with nodes in the range links left over them to the
+ * node after path, a level without only jumps less. The removed nodes
+ * are freed walking the lowest level.
+ * O(logn) + O(k) to free the k nodes
+ */
+template <class T, class Comparator, class Policy>
+void
+SkipList<T, Comparator, Policy> :: cutRange(Node<T>** left, int* left_index,
+    int* left_elem) {
+    int num_cut = index_path_[0] - left_index[0];
+    int elem_cut = elem_path_[0] - left_elem[0];
+    Node<T> *tmp, *next, *it = left[0]->next(0);
+
+    // The paths were searched again without the finger, even for an empty
+    // range, so it doesn't match them anymore
+    finger_ = nullptr;
+
+    if (num_cut <= 0) {
+        return;
+    }
+
+    for (int i = 0; i < level_; ++i) {
+        if (left[i] != path_[i]) {
+            next = path_[i]->next(i);
+            left[i]->next(i) = next;
+            left[i]->jump(i) = next? index_path_[i] + path_[i]->jump(i)
+                - num_cut - left_index[i]: JUMP_TO_NULL;
+            left[i]->span(i) = elem_path_[i] + path_[i]->span(i) - elem_cut
+                - left_elem[i];
+        } else {
+            if (left[i]->jump(i) != JUMP_TO_NULL) {
+                left[i]->jump(i) -= num_cut;
+            }
+
+            left[i]->span(i) -= elem_cut;
+        }
+    }
+
+    next = left[0]->next(0);
+    if (next) {
+        next->prev_ = left[0];
+    } else {
+        head_->prev_ = left[0];
+    }
+
+    for (int k = 0; k < num_cut; ++k) {
+        tmp = it;
+        it = it->next(0);
+        pool_.deleteNode(tmp);
+    }
+
+    num_nodes_ -= num_cut;
+    num_elem_ -= elem_cut;
+
+    // Drop the levels left empty
+    while (level_ > 1 && !head_->next(level_ - 1)) {
+        --level_;
+    }
+}
+
+/*
+ * Insert count keys after a single search and return the node of the key.
+ * The path is left pointing to the node (the finger of the next insertion).
+ */
+template <class T, class Comparator, class Policy>
+template <class Key>
+Node<T>*
+SkipList<T, Comparator, Policy> :: insertNode(Key&& key, int count,
+    bool use_finger) {
+    try {
+        if (count < 1) {
+            throw 1;
+        }
+    } catch (...) {
+        std::cerr << "Standard exception: insertKey negative number of keys\n";
+        return finger_;
+    }
+
+    Node<T> *node;
+
+    findPath(key, use_finger);
+
+    node = path_[0]->next(0);
+    if (node && !(key != node->data_)) {
+        return addCount(node, count);
+    }
+
+    return linkNode(pool_.newNode(getNewHeight(), count,
+        std::forward<Key>(key)));
+}
+
+/*
+ * The key of node is already in the skip list (found by findPath),
+ * only its count grows.
+ */
+template <class T, class Comparator, class Policy>
+Node<T>*
+SkipList<T, Comparator, Policy> :: addCount(Node<T>* node, int count) {
+    num_elem_ += count;
+    node->count_ += count;
+
+    // The levels above the node skip over it
+    for (int i = node->height_; i < level_; ++i) {
+        path_[i]->span(i) += count;
+    }
+    finger_ = node;
+
+    return node;
+}
+
+/*
+ * Link a new node after the path filled by findPath.
+ */
+template <class T, class Comparator, class Policy>
+Node<T>*
+SkipList<T, Comparator, Policy> :: linkNode(Node<T>* node) {
+    int height = node->height_, count = node->count_;
+    int old_jump, old_span, node_elem;
+    Node<T> *tmp;
+
+    num_elem_ += count;
+    ++num_nodes_;
+
+    // New levels start empty: from the head straight to the end
+    for (; level_ < height; ++level_) {
+        path_[level_] = head_;
+        index_path_[level_] = 0;
+        elem_path_[level_] = 0;
+        head_->span(level_) = num_elem_ - count;
+    }
+
+    // Nodes at the same height point to the
+    // new node levels and change their jump
+    tmp = path_[0]->next(0);
+    path_[0]->next(0) = node;
+    node->next(0) = tmp;
+    node->prev_ = path_[0];
+    if (tmp) {
+        tmp->prev_ = node;
+    } else {
+        head_->prev_ = node;
+    }
+
+    old_jump = path_[0]->jump(0);
+    path_[0]->jump(0) = 0;
+    node->jump(0) = old_jump;  // 0 or JUMP_TO_NULL
+
+    old_span = path_[0]->span(0);
+    path_[0]->span(0) = 0;
+    node->span(0) = old_span;
+
+    for (int i = 1; i < height; ++i) {
+        tmp = path_[i]->next(i);
+        path_[i]->next(i) = node;
+        node->next(i) = tmp;
+
+        old_jump = path_[i]->jump(i);
+        // The current node jumps as many nodes as it reaches the node on a
+        // lower level path + as many nodes as it reaches the node inserted
+        path_[i]->jump(i) = index_path_[i - 1] - index_path_[i]
+            + path_[i - 1]->jump(i - 1);
+        // The inserted node jumps over remained nodes or jumps to NULL
+        node->jump(i) = (old_jump == JUMP_TO_NULL)? JUMP_TO_NULL:
+            old_jump - path_[i]->jump(i);
+
+        // Same for keys: the ones up to the new node and the remained ones
+        old_span = path_[i]->span(i);
+        path_[i]->span(i) = elem_path_[0] - elem_path_[i];
+        node->span(i) = old_span - path_[i]->span(i);
+    }
+
+    // The rest of the path with higher levels jump over an extra node
+    for (int i = height; i < level_; ++i) {
+        if (path_[i]->jump(i) != JUMP_TO_NULL) {
+            ++path_[i]->jump(i);
+        }
+
+        path_[i]->span(i) += count;
+    }
+
+    // The new node is now the last node on its levels before the next key
+    node_elem = elem_path_[0] + count;
+    for (int i = height - 1; i > -1; --i) {
+        index_path_[i] = index_path_[0] + 1;
+        elem_path_[i] = node_elem;
+        path_[i] = node;
+    }
+    finger_ = node;
+
+    return node;
+}
+
+/*
+ * Node at position index (the head for -1).
+ * O(logn)
+ */
+template <class T, class Comparator, class Policy>
+Node<T>*
+SkipList<T, Comparator, Policy> :: findIndex(int index) {
+    Node<T> *it = head_;
+
+    settleHead();
+    ++index;
+    for (int i = level_ - 1; i > -1; --i) {
+        while (it->next(i) && index >= it->jump(i) + 1) {
+            index -= it->jump(i) + 1;
+            it = it->next(i);
+        }
+    }
+
+    return it;
+}
+
+/*
+ * Position of the node of it (length for end).
+ * O(logn)
+ */
+template <class T, class Comparator, class Policy>
+int
+SkipList<T, Comparator, Policy> :: indexOf(iterator it) {
+    return it.itr? rank(it.itr->data_): num_nodes_;
+}
+
+/*
+ * Append a copy of every node of other (this one is empty): the towers
+ * keep their heights, so the jumps and spans are copied as they are.
+ * O(n)
+ */
+template <class T, class Comparator, class Policy>
+void
+SkipList<T, Comparator, Policy> ::
+copyFrom(const SkipList<T, Comparator, Policy>& other) {
+    Node<T> *node, *it;
+
+    other.settleHead();
+    for (int i = 0; i < other.level_; ++i) {
+        path_[i] = head_;
+        head_->jump(i) = other.head_->jump(i);
+        head_->span(i) = other.head_->span(i);
+    }
+
+    for (it = other.head_->next(0); it; it = it->next(0)) {
+        node = pool_.newNode(it->height_, it->count_, it->data_);
+        node->prev_ = path_[0];
+
+        for (int i = 0; i < it->height_; ++i) {
+            path_[i]->next(i) = node;
+            node->jump(i) = it->jump(i);
+            node->span(i) = it->span(i);
+            path_[i] = node;
+        }
+    }
+    head_->prev_ = path_[0];
+
+    level_ = other.level_;
+    num_elem_ = other.num_elem_;
+    num_nodes_ = other.num_nodes_;
+    finger_ = nullptr;
+}
+
+/*
+ * The links of the head came from another list: the first node must
+ * point back to this head, and the head of an empty list to itself.
+ */
+template <class T, class Comparator, class Policy>
+void
+SkipList<T, Comparator, Policy> :: relinkHead() {
+    if (head_->next(0)) {
+        head_->next(0)->prev_ = head_;
+    } else {
+        head_->prev_ = head_;
+    }
+}
+
+/*
+ * Apply the pops since the last call to the head. Each level skips one node
+ * less for every node popped since its links were last handed over, and
+ * one key less for every key popped since then, except the keys of the
+ * first node on the levels that end at it.
+ * O(levels), O(1) with no pops
+ */
+template <class T, class Comparator, class Policy>
+void
+SkipList<T, Comparator, Policy> :: settleHead() const {
+    if (pop_elems_ == 0) {
+        return;
+    }
+
+    int height = head_->next(0)? head_->next(0)->height_: 0;
+
+    for (int i = 0; i < level_; ++i) {
+        if (head_->jump(i) != JUMP_TO_NULL) {
+            head_->jump(i) -= pop_nodes_ - pop_nodes_mark_[i];
+        }
+
+        head_->span(i) -= pop_elems_ - pop_elems_mark_[i]
+            - ((i < height)? top_pops_: 0);
+    }
+
+    pop_nodes_ = pop_elems_ = top_pops_ = 0;
+    std::fill(pop_nodes_mark_, pop_nodes_mark_ + Policy::kMaxHeight, 0);
+    std::fill(pop_elems_mark_, pop_elems_mark_ + Policy::kMaxHeight, 0);
+}
+
+/*
+ * Each new level is taken with probability p = PromoteNum / PromoteDen
+ * (one random number for each level).
+ */
+template <class T, class Comparator, class Policy>
 int
-SkipList<T, Comparator> :: getNewHeight() {
-    int height, random;
+SkipList<T, Comparator, Policy> :: getNewHeight() {
+    return Policy::newHeight(new_rand_);
+}
 
-    for (height = 1, random = new_rand_(); random & 1 && height < max_height_;
-        random = (random >>= 1)? random: new_rand_(), ++height) {
+/*
+ * Height of a new node, shared by SkipList and BlockSkipList: one more
+ * level while a draw r - min, uniform in [0, R] (R = max - min), is below
+ * (R + 1) * p. R + 1 wraps for a 64 bit engine, so the threshold is
+ * floor((R + 1) * Num / Den) taken as (R / Den) * Num + (R % Den + 1) *
+ * Num / Den, where no term overflows (Num < Den).
+ */
+template <int MaxHeight, int PromoteNum, int PromoteDen, class Random,
+    int Capacity>
+int
+SkipListPolicy<MaxHeight, PromoteNum, PromoteDen, Random, Capacity> ::
+newHeight(Random& rand) {
+    typedef unsigned long long ull;
+
+    static_assert(PromoteNum > 0 && PromoteNum < PromoteDen,
+        "promote probability must be in (0, 1)");
+    static_assert(static_cast<ull>(Random::max() - Random::min()) >= 0xFFFF,
+        "the generator of a skip list needs a range of at least 2^16");
+
+    const ull range = static_cast<ull>(Random::max() - Random::min());
+    const ull threshold = range / PromoteDen * PromoteNum
+        + (range % PromoteDen + 1) * PromoteNum / PromoteDen;
+    int height;
+
+    for (height = 1; height < MaxHeight && static_cast<ull>(rand()
+        - Random::min()) < threshold; ++height) {
     }
 
     return height;
 }
 
 /*
- * I've left commented code and the worse method to show that
- * the data structure supports random access by index and key,
- * insertion, deletion in logarithmic time with order maintained.
+ * Sort the array with a skip list: every key is inserted and then the
+ * list is read in order by a single walk on the first level, each node
+ * giving its key count times (or once if distinct).
+ * O(nlogn) to build, O(n) to extract
  */
 template <class T, class Container>
 int sortAlgorithm(T* vect, int size, bool distinct) {
-    // typename Container :: iterator it;
+    typename Container :: iterator it;
     Container sklist;
-    int i, j, k, count;
+    int i, k, count;
 
-    // O(nlogn)
     for (i = 0; i < size; ++i) {
         sklist.insertKey(vect[i]);
     }
 
-    // sort and eliminate replicates
-    if (distinct == true) {
-        // O(nlogn)
-        for (i = 0; i < sklist.length(); ++i) {
-            vect[i] = sklist[i];
+    for (i = 0, it = sklist.begin(); it != sklist.end(); ++it) {
+        count = distinct? 1: it.count();
+
+        for (k = 0; k < count; ++k) {
+            vect[i++] = *it;
         }
+    }
 
-        // O(n)
-        // for (i = 0, it = sklist.begin(); it != sklist.end(); ++it) {
-        //    vect[i++] = *it;
-        // }
+    return i;
+}
+
+/*
+ * Merge two sorted runs into out using several threads. The longer run is
+ * cut in equal pieces and each cut is searched in the other run (keys
+ * strictly before it), so the pieces can be merged independently. Keys
+ * from a keep their place before equal keys from b (stable).
+ */
+template <class T, class Comparator>
+void parallelMerge(const T* a, int size_a, const T* b, int size_b, T* out,
+    int num_threads) {
+    Comparator comp;
+    auto before = [comp](const T& lhs, const T& rhs) mutable {
+        return comp(rhs, lhs);
+    };
 
-        return sklist.length();
-    } else {  // just sort
-        // O(k*nlogn)
-        for (i = j = 0; i < sklist.length(); ++i) {
-            count = sklist.countKey(sklist[i]);
+    if (num_threads < 2 || size_a + size_b < SORT_CUTOFF) {
+        std::merge(a, a + size_a, b, b + size_b, out, before);
+        return;
+    }
 
-            for (k = 0; k < count; ++k) {
-                vect[j++] = sklist[i];
+    bool swapped = size_a < size_b;
+    const T *big = swapped? b: a, *small = swapped? a: b;
+    int size_big = swapped? size_b: size_a;
+    int size_small = swapped? size_a: size_b;
+    std::vector<int> cut_big(num_threads + 1), cut_small(num_threads + 1);
+    std::vector<std::thread> workers;
+
+    cut_big[0] = cut_small[0] = 0;
+    cut_big[num_threads] = size_big;
+    cut_small[num_threads] = size_small;
+
+    for (int i = 1; i < num_threads; ++i) {
+        cut_big[i] = static_cast<int>(
+            static_cast<long long>(size_big) * i / num_threads);
+        // a keeps equal keys on its side of the cut, b gives them away
+        cut_small[i] = static_cast<int>((swapped?
+            std::upper_bound(small, small + size_small, big[cut_big[i]],
+                before):
+            std::lower_bound(small, small + size_small, big[cut_big[i]],
+                before)) - small);
+    }
+
+    for (int i = 0; i < num_threads; ++i) {
+        workers.push_back(std::thread([=]() mutable {
+            const T *first_big = big + cut_big[i];
+            const T *first_small = small + cut_small[i];
+            int len_big = cut_big[i + 1] - cut_big[i];
+            int len_small = cut_small[i + 1] - cut_small[i];
+            T *dest = out + cut_big[i] + cut_small[i];
+
+            if (swapped) {
+                std::merge(first_small, first_small + len_small, first_big,
+                    first_big + len_big, dest, before);
+            } else {
+                std::merge(first_big, first_big + len_big, first_small,
+                    first_small + len_small, dest, before);
             }
+        }));
+    }
+
+    for (size_t i = 0; i < workers.size(); ++i) {
+        workers[i].join();
+    }
+}
+
+/*
+ * Parallel mode: the array is cut in num_threads chunks, each one is sorted
+ * by its own skip list, then the sorted runs are merged two by two (the
+ * threads are shared between the merges of a round). For distinct, the
+ * chunks drop their replicates and the ones between chunks are dropped
+ * after the last merge.
+ */
+template <class T, class Container, class Comparator>
+int parallelSortAlgorithm(T* vect, int size, bool distinct, int num_threads) {
+    if (num_threads < 2 || size < 2 * SORT_CUTOFF) {
+        return sortAlgorithm<T, Container>(vect, size, distinct);
+    }
+
+    std::vector<int> first(num_threads), len(num_threads);
+    std::vector<std::thread> workers;
+    std::vector<T> buffer(size);
+    T *src = vect, *dest = buffer.data();
+
+    for (int i = 0; i < num_threads; ++i) {
+        first[i] = static_cast<int>(static_cast<long long>(size) * i
+            / num_threads);
+    }
+
+    for (int i = 0; i < num_threads; ++i) {
+        int last = (i + 1 < num_threads)? first[i + 1]: size;
+
+        workers.push_back(std::thread([&, i, last]() {
+            len[i] = sortAlgorithm<T, Container>(vect + first[i],
+                last - first[i], distinct);
+        }));
+    }
+
+    for (int i = 0; i < num_threads; ++i) {
+        workers[i].join();
+    }
+
+    while (first.size() > 1) {
+        std::vector<int> next_first, next_len;
+        int runs = static_cast<int>(first.size()), pos = 0;
+        int threads_per_merge = std::max(1, num_threads / (runs / 2));
+
+        workers.clear();
+
+        for (int i = 0; i < runs; i += 2) {
+            next_first.push_back(pos);
+
+            if (i + 1 < runs) {
+                workers.push_back(std::thread([=]() {
+                    parallelMerge<T, Comparator>(src + first[i], len[i],
+                        src + first[i + 1], len[i + 1], dest + pos,
+                        threads_per_merge);
+                }));
+                next_len.push_back(len[i] + len[i + 1]);
+            } else {
+                std::copy(src + first[i], src + first[i] + len[i],
+                    dest + pos);
+                next_len.push_back(len[i]);
+            }
+
+            pos += next_len.back();
         }
 
-        // O(k*n)
-        // for (j = 0, it = sklist.begin(); it != sklist.end(); ++it) {
-        //     count = sklist.countKey(*it);
+        for (size_t i = 0; i < workers.size(); ++i) {
+            workers[i].join();
+        }
 
-        //     for (k = 0; k < count; ++k) {
-        //         vect[j++] = *it;
-        //     }
-        // }
+        first.swap(next_first);
+        len.swap(next_len);
+        std::swap(src, dest);
+    }
 
-        return sklist.size();
+    size = len[0];
+    if (distinct) {
+        size = static_cast<int>(std::unique(src, src + size,
+            [](const T& lhs, const T& rhs) { return !(lhs != rhs); }) - src);
     }
+
+    if (src != vect) {
+        std::copy(src, src + size, vect);
+    }
+
+    return size;
 }
 
 /*
  * This sorting functions return also the size if it was changed
  * by calling them with the parameter distinct equal to true.
+ * With num_threads > 1 the array is sorted in parallel.
  */
 template <class T, class Comparator>
-int skipListSort(T* vect, int size, bool distinct = false) {
-    return sortAlgorithm<T, SkipList<T, Comparator> >(vect, size, distinct);
+int skipListSort(T* vect, int size, bool distinct = false,
+    int num_threads = 1) {
+    return parallelSortAlgorithm<T, SkipList<T, Comparator>, Comparator>(
+        vect, size, distinct, num_threads);
 }
 
 template <class T>
-int skipListSort(T* vect, int size, bool distinct = false) {
-    return sortAlgorithm<T, SkipList<T> >(vect, size, distinct);
+int skipListSort(T* vect, int size, bool distinct = false,
+    int num_threads = 1) {
+    return parallelSortAlgorithm<T, SkipList<T>, DefaulComparator<T> >(
+        vect, size, distinct, num_threads);
 }
 
 #endif  // SKIP_LIST_H_
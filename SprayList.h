@@ -0,0 +1,200 @@
+// Copyright 2019 Nedelcu Horia (nedelcu.horia.alexandru@gmail.com)
+
+/**
+*    SprayList Implementation:
+*
+*    Relaxed concurrent priority queue on top of ConcurrentSkipList. Taking
+* the exact top makes every thread fight for the first node (and for the
+* locks of the head when it is unlinked), so popTop "sprays" instead: it
+* starts on the head at level H = log2(p) (p = number of threads) and on
+* each level, down to the lowest, walks a random number of links between 0
+* and L = H + 1. The key after the node it lands on is taken (one copy,
+* with a CAS on its counter). Different threads land on different nodes
+* among the first ones and rarely collide.
+*    Rank error: a link on level i skips 2^i nodes in expectation, so a
+* spray walks past at most L * (2^(H + 1) - 1) < 2 * p * (log2(p) + 1)
+* nodes in expectation and popTop returns one of the first
+* O(p * logp) keys, about uniformly. With p = 1 there is no spray (H = 0,
+* L = 0) and popTop is exact. A pop that keeps colliding falls back to the
+* first free key.
+*    pushKey is insertKey of the skip list.
+*/
+
+#ifndef SPRAY_LIST_H_
+#define SPRAY_LIST_H_
+
+#include <ctime>
+#include <random>
+#include <thread>
+#include <functional>
+
+#include "ConcurrentSkipList.h"
+
+#define SPRAY_RETRIES 4
+
+template <class T, class Comparator = DefaulComparator<T> >
+class SprayList {
+    ConcurrentSkipList<T, Comparator> list_;
+    int spray_height_;
+    int spray_length_;
+
+ public:
+    explicit SprayList(int num_threads = std::thread::hardware_concurrency());
+
+    SprayList(const SprayList<T, Comparator>&) = delete;
+    SprayList<T, Comparator>&
+    operator=(const SprayList<T, Comparator>&) = delete;
+
+    int size();
+    int length();
+    bool isEmpty();
+
+    void pushKey(const T&, int count_ = 1);
+    bool popTop(T&);
+    bool popTopExact(T&);
+
+    void reclaim();
+
+ private:
+    ConcurrentNode<T>* spray();
+};
+
+/*
+ * Implementation:
+ */
+
+template <class T, class Comparator>
+SprayList<T, Comparator> :: SprayList(int num_threads): spray_height_(0),
+    spray_length_(0) {
+    while ((2 << spray_height_) <= num_threads && spray_height_ < H_MAX - 1) {
+        ++spray_height_;
+    }
+
+    spray_length_ = (num_threads > 1)? spray_height_ + 1: 0;
+}
+
+template <class T, class Comparator>
+int
+SprayList<T, Comparator> :: size() {
+    return list_.size();
+}
+
+template <class T, class Comparator>
+int
+SprayList<T, Comparator> :: length() {
+    return list_.length();
+}
+
+template <class T, class Comparator>
+bool
+SprayList<T, Comparator> :: isEmpty() {
+    return list_.isEmpty();
+}
+
+/*
+ * O(logn)
+ */
+template <class T, class Comparator>
+void
+SprayList<T, Comparator> :: pushKey(const T& key, int count) {
+    list_.insertKey(key, count);
+}
+
+/*
+ * Take one of the first keys (see rank error above) and write it in key.
+ * Return false if the queue is empty.
+ * O(logp) for the spray + O(logn) to unlink the node when its count ends
+ */
+template <class T, class Comparator>
+bool
+SprayList<T, Comparator> :: popTop(T& key) {
+    typename ConcurrentSkipList<T, Comparator>::Guard guard(&list_.epochs_);
+    ConcurrentNode<T> *node;
+
+    for (int attempt = 0; attempt < SPRAY_RETRIES; ++attempt) {
+        node = spray();
+
+        if (!node) {
+            break;
+        }
+
+        if (list_.takeCount(node, 1)) {
+            key = node->data_;
+            return true;
+        }
+    }
+
+    return popTopExact(key);
+}
+
+/*
+ * Take the first key that is still free (contended, like a plain skip list
+ * used as a queue). Return false if the queue is empty.
+ * O(logn) + O(number of keys being taken by other threads)
+ */
+template <class T, class Comparator>
+bool
+SprayList<T, Comparator> :: popTopExact(T& key) {
+    typename ConcurrentSkipList<T, Comparator>::Guard guard(&list_.epochs_);
+    ConcurrentNode<T> *node = list_.skipMarked(
+        list_.head_->next_[0].load(std::memory_order_acquire));
+
+    for (; node; node = list_.skipMarked(
+        node->next_[0].load(std::memory_order_acquire))) {
+        if (list_.takeCount(node, 1)) {
+            key = node->data_;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Free the unlinked nodes no thread can still reach (see
+ * ConcurrentSkipList::reclaim).
+ */
+template <class T, class Comparator>
+void
+SprayList<T, Comparator> :: reclaim() {
+    list_.reclaim();
+}
+
+/*
+ * Random walk from the head: a random number of links in [0, L] on each
+ * level from H down to 0. The node after the last one reached is returned
+ * (the first node if the walk went past the end, NULL for an empty list).
+ * Every thread has its own generator. Called with a guard (popTop).
+ */
+template <class T, class Comparator>
+ConcurrentNode<T>*
+SprayList<T, Comparator> :: spray() {
+    static thread_local std::minstd_rand spray_rand_(
+        static_cast<unsigned int>(time(nullptr)) ^ static_cast<unsigned int>(
+        std::hash<std::thread::id>()(std::this_thread::get_id())));
+    ConcurrentNode<T> *next, *it = list_.head_;
+    int steps;
+
+    for (int i = spray_height_; i > -1; --i) {
+        steps = spray_rand_() % (spray_length_ + 1);
+
+        for (; steps > 0; --steps) {
+            next = it->next_[i].load(std::memory_order_acquire);
+            if (!next) {
+                break;
+            }
+
+            it = next;
+        }
+    }
+
+    next = list_.skipMarked(it->next_[0].load(std::memory_order_acquire));
+    if (!next) {
+        next = list_.skipMarked(
+            list_.head_->next_[0].load(std::memory_order_acquire));
+    }
+
+    return next;
+}
+
+#endif  // SPRAY_LIST_H_
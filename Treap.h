@@ -1,19 +1,83 @@
+#include <ctime>
+#include <future>
+#include <limits>
+#include <thread>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <utility>
+#include <iostream>
+
+#include "FrozenTreap.h"
+
+// Below this many keys (both sides) a set operation runs on one thread
+#define TREAP_PARALLEL_CUTOFF (1 << 14)
+// Number of keys scan gives to the visitor at once
+#define TREAP_SCAN_BATCH 256
+
 using namespace std;
 
-template <typename T> struct Treap {
+/*
+ * Aggregates kept by Treap in every node, over the keys of its subtree: a
+ * Value type, identity(), of(key) and an associative combine(lhs, rhs),
+ * where lhs comes from the smaller keys.
+ */
+template <typename T> struct NoAggregate {
+    struct Value {};
+
+    static Value identity() { return Value(); }
+    static Value of(const T&) { return Value(); }
+    static Value combine(const Value&, const Value&) { return Value(); }
+};
+
+template <typename T> struct SumAggregate {
+    typedef T Value;
+
+    static Value identity() { return T(); }
+    static Value of(const T& key) { return key; }
+    static Value combine(const Value& lhs, const Value& rhs) {
+        return lhs + rhs;
+    }
+};
+
+template <typename T> struct MinAggregate {
+    typedef T Value;
+
+    static Value identity() { return numeric_limits<T>::max(); }
+    static Value of(const T& key) { return key; }
+    static Value combine(const Value& lhs, const Value& rhs) {
+        return (rhs < lhs)? rhs: lhs;
+    }
+};
+
+template <typename T> struct MaxAggregate {
+    typedef T Value;
+
+    static Value identity() { return numeric_limits<T>::lowest(); }
+    static Value of(const T& key) { return key; }
+    static Value combine(const Value& lhs, const Value& rhs) {
+        return (lhs < rhs)? rhs: lhs;
+    }
+};
+
+template <typename T, class Monoid = NoAggregate<T> > struct Treap {
     T key;
     int priority;
-    Treap<T> *left, *right;
+    Treap *left, *right;
     bool nil;
+    typename Monoid::Value agg;
     int nr_nodes;
 
-    Treap() : priority(-1), left(NULL), right(NULL), nil(true), nr_nodes(0) {}
+    Treap() : priority(-1), left(NULL), right(NULL), nil(true),
+        agg(Monoid::identity()), nr_nodes(0) {}
 
     void addData(T key, int priority) {
         this->nil = false;
         this->key = key;
         this->priority = priority;
         this->nr_nodes = 1;
+        this->agg = Monoid::of(key);
         this->left = new Treap();
         this->right = new Treap();
     }
@@ -24,6 +88,7 @@ template <typename T> struct Treap {
         delete this->left;
         delete this->right;
         this->nr_nodes = 0;
+        this->agg = Monoid::identity();
     }
 
     bool isNil() {
@@ -35,7 +100,7 @@ template <typename T> struct Treap {
             return false;
         }
 
-        Treap<T>* it = this;
+        Treap* it = this;
 
         while (!it->nil) {
             if (it->key == key) {
@@ -50,80 +115,663 @@ template <typename T> struct Treap {
         return false;
     }
 
-    void rotateRight(Treap<T> *&f) {
+    void rotateRight(Treap *&f) {
         Treap* l = f->left;
         f->left = l->right;
         l->right = f;
-        
-        f->nr_nodes = f->left->nr_nodes + f->right->nr_nodes + 1;
-        l->nr_nodes = l->left->nr_nodes + l->right->nr_nodes + 1;
+
+        update(f);
+        update(l);
 
         f = l;
     }
 
-    void rotateLeft(Treap<T> *&f) {
+    void rotateLeft(Treap *&f) {
    	    Treap* r = f->right;
         f->right = r->left;
         r->left = f;
 
-        f->nr_nodes = f->left->nr_nodes + f->right->nr_nodes + 1;
-        r->nr_nodes = r->left->nr_nodes + r->right->nr_nodes + 1;
+        update(f);
+        update(r);
 
         f = r;
     }
 
-    void insert(Treap<T> *&f, T key, int priority) {
-        if (f->isNil()) {
-            f->addData(key, priority);
+    /*
+     * Insert key without recursion: go down while the nodes have higher
+     * priorities, split the subtree found there by key (keys < key to the
+     * left of the new node, the others to the right) and put the new node
+     * in its place. The nodes passed are then updated bottom-up.
+     * O(logn)
+     */
+    void insert(Treap *&f, T key, int priority) {
+        vector<Treap*>& path = updatePath();
+        Treap **link = &f, *it, *node = new Treap();
+        Treap **left = &node->left, **right = &node->right;
+
+        while (!(*link)->isNil() && (*link)->priority >= priority) {
+            path.push_back(*link);
+            link = (key < (*link)->key)? &(*link)->left: &(*link)->right;
+        }
+
+        size_t above = path.size();
 
+        for (it = *link; !it->isNil();) {
+            path.push_back(it);
+
+            if (it->key < key) {
+                *left = it;
+                left = &it->right;
+                it = it->right;
+            } else {
+                *right = it;
+                right = &it->left;
+                it = it->left;
+            }
+        }
+
+        *left = it;
+        *right = new Treap();
+
+        node->nil = false;
+        node->key = key;
+        node->priority = priority;
+        *link = node;
+
+        updateBelow(path, above);
+        update(node);
+        updateBelow(path, 0);
+    }
+
+    // Insert key with a priority from the built-in generator
+    void insert(Treap *&f, T key) {
+        insert(f, key, randomPriority());
+    }
+
+    /*
+     * Erase one copy of key without recursion: its two subtrees are merged
+     * down their inner spines (left->right..., right->left...) in its place.
+     * O(logn)
+     */
+    void erase(Treap *&f, T key) {
+        vector<Treap*>& path = updatePath();
+        Treap **link = &f, *node, *left, *right;
+
+        while (!(*link)->isNil() && (key < (*link)->key
+            || (*link)->key < key)) {
+            path.push_back(*link);
+            link = (key < (*link)->key)? &(*link)->left: &(*link)->right;
+        }
+
+        if ((*link)->isNil()) {
             return;
         }
 
-        if (key < f->key) {
-            insert(f->left, key, priority);
+        node = *link;
+        left = node->left;
+        right = node->right;
+
+        while (!left->isNil() && !right->isNil()) {
+            if (left->priority > right->priority) {
+                *link = left;
+                path.push_back(left);
+                link = &left->right;
+                left = left->right;
+            } else {
+                *link = right;
+                path.push_back(right);
+                link = &right->left;
+                right = right->left;
+            }
+        }
+
+        if (left->isNil()) {
+            *link = right;
+            delete left;
         } else {
-            insert(f->right, key, priority);
+            *link = left;
+            delete right;
+        }
+
+        delete node;
+        updateBelow(path, 0);
+    }
+
+    /*
+     * Replace the tree of f with the keys of [first, last), sorted, as a
+     * Cartesian tree built left to right with its right spine on a stack:
+     * a new key pops the nodes of lower priority (their subtrees are now
+     * complete, so they get their nil children and are updated) and takes
+     * the last one popped as its left child. If the range turns out not to
+     * be sorted, the rest of it is inserted one key at a time.
+     * O(n) for a sorted range
+     */
+    template <class Iterator>
+    void build(Treap *&f, Iterator first, Iterator last) {
+        vector<Treap*>& spine = updatePath();
+        Treap *node, *child;
+
+        destroy(f);
+
+        for (; first != last; ++first) {
+            if (!spine.empty() && *first < spine.back()->key) {
+                cerr << "Standard exception: build range is not sorted\n";
+                break;
+            }
+
+            node = new Treap();
+            node->nil = false;
+            node->key = *first;
+            node->priority = randomPriority();
+
+            for (child = NULL; !spine.empty()
+                && spine.back()->priority < node->priority; spine.pop_back()) {
+                child = closeNode(spine.back());
+            }
+
+            node->left = child;
+            if (!spine.empty()) {
+                spine.back()->right = node;
+            }
+            spine.push_back(node);
+        }
+
+        for (child = NULL; !spine.empty(); spine.pop_back()) {
+            child = closeNode(spine.back());
+        }
+
+        f = child? child: new Treap();
+
+        for (; first != last; ++first) {
+            insert(f, *first);
+        }
+    }
+
+    // A node of build whose subtree is complete
+    Treap* closeNode(Treap* f) {
+        if (!f->left) {
+            f->left = new Treap();
         }
 
-        if (f->left->priority > f->priority) {
-            rotateRight(f);
-        } else if (f->right->priority > f->priority) {
-            rotateLeft(f);
+        if (!f->right) {
+            f->right = new Treap();
         }
 
+        update(f);
+        return f;
+    }
+
+    // Update path[i] for i from the end down to first
+    void updateBelow(vector<Treap*>& path, size_t first) {
+        while (path.size() > first) {
+            update(path.back());
+            path.pop_back();
+        }
+    }
+
+    // Scratch stack of the iterative updates, one per thread
+    static vector<Treap*>& updatePath() {
+        static thread_local vector<Treap*> path;
+
+        path.clear();
+        return path;
+    }
+
+    // xorshift32, one generator per thread; priorities are >= 0 (nil is -1)
+    static int randomPriority() {
+        static thread_local uint32_t state =
+            static_cast<uint32_t>(time(nullptr)) | 1;
+
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+
+        return static_cast<int>(state >> 1);
+    }
+
+    // Recompute nr_nodes and the aggregate of f from its children
+    void update(Treap* f) {
         f->nr_nodes = f->left->nr_nodes + f->right->nr_nodes + 1;
+        f->agg = Monoid::combine(Monoid::combine(f->left->agg,
+            Monoid::of(f->key)), f->right->agg);
     }
 
-    void erase(Treap<T> *&f, T key) {
+    /*
+     * Aggregate of the keys in [lo, hi), in order. The search goes down
+     * to the first node inside the range, then the bounds go down on its
+     * two sides, and every subtree hanging inside the range gives its agg.
+     * O(logn)
+     */
+    typename Monoid::Value aggregate(T lo, T hi) {
+        Treap* it = this;
+
+        while (!it->isNil() && (it->key < lo || !(it->key < hi))) {
+            it = (it->key < lo)? it->right: it->left;
+        }
+
+        if (it->isNil()) {
+            return Monoid::identity();
+        }
+
+        return Monoid::combine(Monoid::combine(aggregateFrom(it->left, lo),
+            Monoid::of(it->key)), aggregateBelow(it->right, hi));
+    }
+
+    // Aggregate of the keys >= lo in the subtree of f
+    typename Monoid::Value aggregateFrom(Treap* f, const T& lo) {
         if (f->isNil()) {
-            return ;
+            return Monoid::identity();
         }
 
-        bool notdel = true;
+        if (f->key < lo) {
+            return aggregateFrom(f->right, lo);
+        }
+
+        return Monoid::combine(aggregateFrom(f->left, lo),
+            Monoid::combine(Monoid::of(f->key), f->right->agg));
+    }
+
+    // Aggregate of the keys < hi in the subtree of f
+    typename Monoid::Value aggregateBelow(Treap* f, const T& hi) {
+        if (f->isNil()) {
+            return Monoid::identity();
+        }
+
+        if (!(f->key < hi)) {
+            return aggregateBelow(f->left, hi);
+        }
+
+        return Monoid::combine(Monoid::combine(f->left->agg,
+            Monoid::of(f->key)), aggregateBelow(f->right, hi));
+    }
+
+    /*
+     * Free a whole subtree (nil nodes included). Left children are rotated
+     * up until the node has none, then the node goes and its right subtree
+     * is next, so the stack doesn't grow with the height of the treap.
+     * O(n)
+     */
+    void destroy(Treap* f) {
+        Treap *left, *next;
+
+        while (!f->isNil()) {
+            left = f->left;
+
+            if (!left->isNil()) {
+                f->left = left->right;
+                left->right = f;
+                f = left;
+            } else {
+                next = f->right;
+                delete left;
+                delete f;
+                f = next;
+            }
+        }
+
+        delete f;
+    }
+
+    /*
+     * Split the tree of f in left (keys < key) and right (keys >= key).
+     * The nodes are moved, f is not valid anymore.
+     * O(logn)
+     */
+    void split(Treap* f, T key, Treap *&left, Treap *&right) {
+        if (f->isNil()) {
+            left = f;
+            right = new Treap();
+
+            return;
+        }
+
+        if (f->key < key) {
+            split(f->right, key, f->right, right);
+            left = f;
+        } else {
+            split(f->left, key, left, f->left);
+            right = f;
+        }
+
+        update(f);
+    }
+
+    // Same as split, but keys equal to key go left (keys <= key, keys > key)
+    void splitUpper(Treap* f, T key, Treap *&left, Treap *&right) {
+        if (f->isNil()) {
+            left = f;
+            right = new Treap();
+
+            return;
+        }
 
         if (key < f->key) {
-            erase(f->left, key);
-        } else if (key > f->key) {
-            erase(f->right, key);
-        } else if (f->left->isNil() && f->right->isNil()) {
-            f->delData();
-            notdel = false;
+            splitUpper(f->left, key, left, f->left);
+            right = f;
         } else {
-            if (f->left->priority > f->right->priority) {
-                rotateRight(f);
-                erase(f->right, key);
+            splitUpper(f->right, key, f->right, right);
+            left = f;
+        }
+
+        update(f);
+    }
+
+    /*
+     * Join two trees where every key of left is <= every key of right.
+     * Return the new root, left and right are not valid anymore.
+     * O(logn)
+     */
+    Treap* merge(Treap* left, Treap* right) {
+        if (left->isNil()) {
+            delete left;
+            return right;
+        }
+
+        if (right->isNil()) {
+            delete right;
+            return left;
+        }
+
+        if (left->priority > right->priority) {
+            left->right = merge(left->right, right);
+            update(left);
+
+            return left;
+        }
+
+        right->left = merge(left, right->left);
+        update(right);
+
+        return right;
+    }
+
+    /*
+     * Set operations on the trees of f and other (taken as sets: a key of
+     * other equal to a key of f is the same key). Both trees are consumed
+     * and the root of the result is returned; the nodes are reused, the
+     * dropped ones are freed.
+     *    They are join based: the root with the higher priority splits the
+     * other tree and the two halves are solved independently, on two
+     * threads while there are threads left and the trees are big.
+     * O(mlog(n/m + 1)), m <= n the sizes of the trees
+     */
+    Treap* unionWith(Treap* f, Treap* other,
+        int threads = thread::hardware_concurrency()) {
+        Treap *left, *equal, *right;
+
+        if (f->isNil()) {
+            delete f;
+            return other;
+        }
+
+        if (other->isNil()) {
+            delete other;
+            return f;
+        }
+
+        if (f->priority < other->priority) {
+            swap(f, other);
+        }
+
+        split(other, f->key, left, right);
+        splitUpper(right, f->key, equal, right);
+        destroy(equal);
+
+        forkJoin(f->nr_nodes + left->nr_nodes + right->nr_nodes, threads,
+            [&](int t) { f->left = unionWith(f->left, left, t); },
+            [&](int t) { f->right = unionWith(f->right, right, t); });
+
+        update(f);
+        return f;
+    }
+
+    Treap* intersect(Treap* f, Treap* other,
+        int threads = thread::hardware_concurrency()) {
+        Treap *left, *equal, *right;
+
+        if (f->isNil() || other->isNil()) {
+            destroy(other);
+            destroy(f);
+
+            return new Treap();
+        }
+
+        if (f->priority < other->priority) {
+            swap(f, other);
+        }
+
+        split(other, f->key, left, right);
+        splitUpper(right, f->key, equal, right);
+
+        forkJoin(f->nr_nodes + left->nr_nodes + right->nr_nodes, threads,
+            [&](int t) { left = intersect(f->left, left, t); },
+            [&](int t) { right = intersect(f->right, right, t); });
+
+        if (equal->isNil()) {
+            delete f;
+            delete equal;
+
+            return merge(left, right);
+        }
+
+        destroy(equal);
+        f->left = left;
+        f->right = right;
+        update(f);
+
+        return f;
+    }
+
+    // Keys of f that are not in other
+    Treap* difference(Treap* f, Treap* other,
+        int threads = thread::hardware_concurrency()) {
+        Treap *left, *equal, *right;
+
+        if (f->isNil() || other->isNil()) {
+            destroy(other);
+            return f;
+        }
+
+        if (f->priority > other->priority) {
+            split(other, f->key, left, right);
+            splitUpper(right, f->key, equal, right);
+
+            forkJoin(f->nr_nodes + left->nr_nodes + right->nr_nodes, threads,
+                [&](int t) { left = difference(f->left, left, t); },
+                [&](int t) { right = difference(f->right, right, t); });
+
+            if (equal->isNil()) {
+                delete equal;
+                f->left = left;
+                f->right = right;
+                update(f);
+
+                return f;
+            }
+
+            destroy(equal);
+            delete f;
+
+            return merge(left, right);
+        }
+
+        // The root of other splits f, the key of the root is dropped
+        split(f, other->key, left, right);
+        splitUpper(right, other->key, equal, right);
+        destroy(equal);
+
+        forkJoin(other->nr_nodes + left->nr_nodes + right->nr_nodes, threads,
+            [&](int t) { left = difference(left, other->left, t); },
+            [&](int t) { right = difference(right, other->right, t); });
+
+        delete other;
+        return merge(left, right);
+    }
+
+    /*
+     * Run first and second, in parallel if there are at least two threads
+     * and size keys; the threads are shared between them.
+     */
+    template <class First, class Second>
+    void forkJoin(int size, int threads, First first, Second second) {
+        if (threads < 2 || size < TREAP_PARALLEL_CUTOFF) {
+            first(1);
+            second(1);
+
+            return;
+        }
+
+        future<void> task = async(launch::async, first, threads / 2);
+        second(threads - threads / 2);
+        task.get();
+    }
+
+    /*
+     * In order iterator over the keys, with an explicit stack: the nodes
+     * on the path whose key is not visited yet, the current one on top.
+     * Each key is visited once, O(1) amortized per step. The tree must not
+     * change while the iterator is used.
+     */
+    class const_iterator {
+        vector<const Treap*> stack_;
+
+     public:
+        typedef forward_iterator_tag iterator_category;
+        typedef T value_type;
+        typedef ptrdiff_t difference_type;
+        typedef const T* pointer;
+        typedef const T& reference;
+
+        const_iterator() {}
+
+        // The first key of the tree of f
+        explicit const_iterator(const Treap* f) {
+            pushLeft(f);
+        }
+
+        // The first key of the tree of f that is >= key
+        const_iterator(const Treap* f, const T& key) {
+            while (!f->nil) {
+                if (f->key < key) {
+                    f = f->right;
+                } else {
+                    stack_.push_back(f);
+                    f = f->left;
+                }
+            }
+        }
+
+        reference operator*() const {
+            return stack_.back()->key;
+        }
+
+        pointer operator->() const {
+            return &stack_.back()->key;
+        }
+
+        const_iterator& operator++() {
+            const Treap* f = stack_.back();
+
+            stack_.pop_back();
+            pushLeft(f->right);
+
+            return *this;
+        }
+
+        const_iterator operator++(int) {
+            const_iterator it = *this;
+            ++*this;
+
+            return it;
+        }
+
+        bool operator==(const const_iterator& other) const {
+            return stack_.empty()? other.stack_.empty():
+                !other.stack_.empty() && stack_.back() == other.stack_.back();
+        }
+
+        bool operator!=(const const_iterator& other) const {
+            return !(*this == other);
+        }
+
+     private:
+        void pushLeft(const Treap* f) {
+            for (; !f->nil; f = f->left) {
+                stack_.push_back(f);
+            }
+        }
+    };
+
+    typedef const_iterator iterator;
+
+    const_iterator begin() const {
+        return const_iterator(this);
+    }
+
+    const_iterator end() const {
+        return const_iterator();
+    }
+
+    /*
+     * First key >= key (end() if there is none).
+     * O(logn)
+     */
+    const_iterator lower_bound(const T& key) const {
+        return const_iterator(this, key);
+    }
+
+    /*
+     * Give the keys in [lo, hi), in order, to visit(keys, n): keys[i]
+     * points to the key in its node (nothing is copied), n <= TREAP_SCAN_BATCH.
+     * The walk uses one stack for the whole scan, no recursion.
+     * O(logn + number of keys)
+     */
+    template <class Visitor>
+    void scan(const T& lo, const T& hi, Visitor visit) const {
+        const T* batch[TREAP_SCAN_BATCH];
+        vector<const Treap*> stack;
+        const Treap* f = this;
+        int n = 0;
+
+        while (!f->nil) {
+            if (f->key < lo) {
+                f = f->right;
             } else {
-                rotateLeft(f);
-                erase(f->left, key);
+                stack.push_back(f);
+                f = f->left;
             }
         }
 
-        if (notdel) {
-            f->nr_nodes = f->left->nr_nodes + f->right->nr_nodes + 1;
+        while (!stack.empty() && stack.back()->key < hi) {
+            f = stack.back();
+            stack.pop_back();
+
+            batch[n++] = &f->key;
+            if (n == TREAP_SCAN_BATCH) {
+                visit(static_cast<const T* const*>(batch), n);
+                n = 0;
+            }
+
+            for (f = f->right; !f->nil; f = f->left) {
+                stack.push_back(f);
+            }
         }
+
+        if (n) {
+            visit(static_cast<const T* const*>(batch), n);
+        }
+    }
+
+    /*
+     * Immutable copy of the tree in one contiguous array, laid out for fast
+     * searches (see FrozenTreap).
+     * O(n)
+     */
+    FrozenTreap<T> freeze() const {
+        return FrozenTreap<T>(begin(), end());
     }
 
-    void dfs(Treap<T>* root) {
+    void dfs(Treap* root) {
     	if (root->isNil()) {
     		return;
     	}
@@ -141,14 +789,14 @@ template <typename T> struct Treap {
         dfs(this);
     }
 
-    void dfs_(Treap<T>* root) {
+    void dfs_(Treap* root) {
     	if (root->isNil()) {
     		return;
     	}
 
     	cout << root->priority << ' ';
-    	dfs(root->left);
-    	dfs(root->right);
+    	dfs_(root->left);
+    	dfs_(root->right);
     }
 
     void preOrder(int level = 0) {
@@ -156,11 +804,11 @@ template <typename T> struct Treap {
             return ;
         }
 
-        dfs(this);
+        dfs_(this);
     }
 
     T findK(int k) {
-    	Treap<T>* it = this;
+    	Treap* it = this;
 
     	while (true) {
     		if (k == it->left->nr_nodes + 1) {
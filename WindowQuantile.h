@@ -0,0 +1,210 @@
+// Copyright 2019 Nedelcu Horia (nedelcu.horia.alexandru@gmail.com)
+
+/**
+*    WindowQuantile Implementation:
+*
+*    Order statistics over the last window samples of a stream (rolling
+* median, p99, ...). The samples are kept twice: in arrival order in a ring
+* buffer (to know which one leaves) and sorted in a SkipList, where equal
+* samples share one node (count), so a window with many repeated values
+* takes few nodes.
+*    A new sample in a full window replaces the oldest one with
+* SkipList::replaceKey: one pass finds both paths (they share the levels
+* where they meet) and no count check is made beforehand. A quantile is
+* the key at an element rank (SkipList::elementAt, it follows the span
+* of the links). A batch that is a big part of the window rebuilds the
+* list from the sorted window instead (SkipList::assign).
+*    Quantile q is the nearest-rank one: the sample at position
+* ceil(q * size) - 1 in sorted order (the first one for q = 0).
+*/
+
+#ifndef WINDOW_QUANTILE_H_
+#define WINDOW_QUANTILE_H_
+
+#include <cmath>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+
+#include "SkipList.h"
+
+template <class T, class Comparator = DefaulComparator<T>,
+    class Policy = SkipListPolicy<> >
+class WindowQuantile {
+    int window_;
+    int next_;
+    int filled_;
+    std::vector<T> samples_;
+    SkipList<T, Comparator, Policy> list_;
+    Comparator comp_;
+
+ public:
+    explicit WindowQuantile(int window);
+
+    int size();
+    int window();
+    bool isEmpty();
+
+    void push(const T&);
+    void pushBatch(const T*, int);
+    void clear();
+
+    T quantile(double q);
+    void quantiles(const double*, int, T*);
+
+ private:
+    int quantileRank(double q);
+};
+
+/*
+ * Implementation:
+ */
+
+template <class T, class Comparator, class Policy>
+WindowQuantile<T, Comparator, Policy> :: WindowQuantile(int window):
+    window_(window), next_(0), filled_(0), comp_() {
+    try {
+        if (window < 1) {
+            throw 1;
+        }
+    } catch (...) {
+        std::cerr << "Standard exception: window of less than one sample\n";
+        window_ = 1;
+    }
+
+    samples_.resize(window_);
+}
+
+template <class T, class Comparator, class Policy>
+int
+WindowQuantile<T, Comparator, Policy> :: size() {
+    return filled_;
+}
+
+template <class T, class Comparator, class Policy>
+int
+WindowQuantile<T, Comparator, Policy> :: window() {
+    return window_;
+}
+
+template <class T, class Comparator, class Policy>
+bool
+WindowQuantile<T, Comparator, Policy> :: isEmpty() {
+    return filled_ == 0;
+}
+
+/*
+ * Add a sample; in a full window the oldest one leaves.
+ * O(logw)
+ */
+template <class T, class Comparator, class Policy>
+void
+WindowQuantile<T, Comparator, Policy> :: push(const T& sample) {
+    if (filled_ < window_) {
+        list_.insertKey(sample);
+        ++filled_;
+    } else {
+        list_.replaceKey(samples_[next_], sample);
+    }
+
+    samples_[next_] = sample;
+    next_ = (next_ + 1) % window_;
+}
+
+/*
+ * Add n samples in order. If they are at least a quarter of the window,
+ * the window left after them is sorted and the list is built again in
+ * linear time, otherwise they are pushed one by one.
+ * O(nlogw) or O(wlogw) for a big batch
+ */
+template <class T, class Comparator, class Policy>
+void
+WindowQuantile<T, Comparator, Policy> :: pushBatch(const T* samples, int n) {
+    if (4 * static_cast<long long>(n) < window_) {
+        for (int i = 0; i < n; ++i) {
+            push(samples[i]);
+        }
+
+        return;
+    }
+
+    std::vector<T> recent;
+    int keep = std::min(filled_, std::max(window_ - n, 0));
+
+    // The newest samples of the window, oldest first, then the batch
+    recent.reserve(std::min(window_, keep + n));
+    for (int i = filled_ - keep; i < filled_; ++i) {
+        recent.push_back(samples_[(next_ - filled_ + i + window_) % window_]);
+    }
+    recent.insert(recent.end(), samples + std::max(n - window_, 0),
+        samples + n);
+
+    filled_ = static_cast<int>(recent.size());
+    next_ = filled_ % window_;
+    std::copy(recent.begin(), recent.end(), samples_.begin());
+
+    std::sort(recent.begin(), recent.end(), [this](const T& lhs,
+        const T& rhs) {
+        return comp_(rhs, lhs);
+    });
+    list_.assign(recent.begin(), recent.end());
+}
+
+template <class T, class Comparator, class Policy>
+void
+WindowQuantile<T, Comparator, Policy> :: clear() {
+    list_.clear();
+    next_ = 0;
+    filled_ = 0;
+}
+
+/*
+ * Nearest-rank quantile q (0 <= q <= 1) of the samples in the window.
+ * O(logw)
+ */
+template <class T, class Comparator, class Policy>
+T
+WindowQuantile<T, Comparator, Policy> :: quantile(double q) {
+    try {
+        if (filled_ == 0) {
+            throw 1;
+        }
+    } catch (...) {
+        std::cerr << "Standard exception: empty window\n";
+        return T();
+    }
+
+    return list_.elementAt(quantileRank(q));
+}
+
+/*
+ * out[i] = quantile(q[i]) for n quantiles, on the same window.
+ * O(nlogw)
+ */
+template <class T, class Comparator, class Policy>
+void
+WindowQuantile<T, Comparator, Policy> :: quantiles(const double* q, int n,
+    T* out) {
+    for (int i = 0; i < n; ++i) {
+        out[i] = quantile(q[i]);
+    }
+}
+
+template <class T, class Comparator, class Policy>
+int
+WindowQuantile<T, Comparator, Policy> :: quantileRank(double q) {
+    try {
+        if (!(q >= 0 && q <= 1)) {
+            throw 1;
+        }
+    } catch (...) {
+        std::cerr << "Standard exception: quantile outside [0, 1]\n";
+        q = (q > 1)? 1: 0;
+    }
+
+    int rank = static_cast<int>(std::ceil(q * filled_)) - 1;
+
+    return std::min(std::max(rank, 0), filled_ - 1);
+}
+
+#endif  // WINDOW_QUANTILE_H_